@@ -0,0 +1,151 @@
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "adaptive.h"
+
+namespace PololuJrkUSB {
+
+// Variables read on every full-rate tick
+constexpr JrkVar FullSuite[] = {
+  JrkVar::DutyCycle, JrkVar::Target, JrkVar::Feedback,
+  JrkVar::Current, JrkVar::Errors,
+};
+
+// Bytes on the wire for one read of each of vars: command plus reply
+template<size_t N>
+constexpr unsigned WireBytes(const JrkVar (&vars)[N]) {
+  unsigned bytes = 0;
+  for(auto v : vars){
+    bytes += 1 + JrkDescribe(v).width;
+  }
+  return bytes;
+}
+
+constexpr unsigned FullSuiteBytes = WireBytes(FullSuite);
+constexpr unsigned HeartbeatBytes = 1 + JrkDescribe(JrkVar::Errors).width;
+
+AdaptivePoller::AdaptivePoller(Poller& p, const AdaptiveConfig& config) :
+poller(p),
+cfg(config),
+stopped(false),
+kicked(false),
+lasterrors(0),
+havetarget(false),
+lasttarget(0),
+start(clock::now()),
+lastactive(start),
+period(cfg.active_period),
+stats() {
+}
+
+void AdaptivePoller::Stop() {
+  std::lock_guard<std::mutex> guard(lock);
+  stopped = true;
+  cv.notify_all();
+}
+
+void AdaptivePoller::Kick() {
+  std::lock_guard<std::mutex> guard(lock);
+  lastactive = clock::now();
+  kicked = true;
+  cv.notify_all();
+}
+
+void AdaptivePoller::SetJrkTarget(int target) {
+  poller.SetJrkTarget(target);
+  Kick();
+}
+
+void AdaptivePoller::OnReply(const JrkVariable& var, int value) {
+  std::lock_guard<std::mutex> guard(lock);
+  switch(var.id){
+    case JrkVar::DutyCycle:
+      if(value){
+        lastactive = clock::now();
+      }
+      break;
+    case JrkVar::Target:
+      if(havetarget && value != lasttarget){
+        lastactive = clock::now();
+      }
+      havetarget = true;
+      lasttarget = value;
+      break;
+    case JrkVar::Errors:
+      if(value != lasterrors){
+        lasterrors = value;
+        lastactive = clock::now();
+        ++stats.bursts;
+        kicked = true;
+        cv.notify_all();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void AdaptivePoller::Run() {
+  std::unique_lock<std::mutex> lk(lock);
+  auto next = clock::now();
+  while(!stopped){
+    cv.wait_until(lk, next, [&]{ return stopped || kicked; });
+    if(stopped){
+      break;
+    }
+    auto now = clock::now();
+    if(!kicked && now < next){
+      continue;
+    }
+    kicked = false;
+    const bool active = now - lastactive < cfg.hold;
+    if(active){
+      period = cfg.active_period;
+    }else{
+      period = std::min(period * cfg.decay, cfg.idle_period);
+    }
+    next = now + period;
+    lk.unlock();
+    try{
+      if(active){
+        for(auto v : FullSuite){
+          poller.ReadJrk(v);
+        }
+      }else{
+        poller.ReadJrkErrors();
+      }
+    }catch(std::runtime_error& e){
+      // e.g. the device went away; there's no point in carrying on
+      std::cerr << "error sampling jrk: " << e.what() << std::endl;
+      lk.lock();
+      error = e.what();
+      stopped = true;
+      break;
+    }
+    lk.lock();
+    if(active){
+      ++stats.full_samples;
+      stats.bytes += FullSuiteBytes;
+    }else{
+      ++stats.heartbeats;
+      stats.bytes += HeartbeatBytes;
+    }
+  }
+}
+
+std::string AdaptivePoller::Error() {
+  std::lock_guard<std::mutex> guard(lock);
+  return error;
+}
+
+AdaptiveStats AdaptivePoller::Stats() {
+  std::lock_guard<std::mutex> guard(lock);
+  AdaptiveStats ret = stats;
+  ret.seconds = std::chrono::duration<double>(clock::now() - start).count();
+  const double ticks = ret.seconds /
+    std::chrono::duration<double>(cfg.active_period).count();
+  ret.baseline_bytes = static_cast<uint64_t>(ticks * FullSuiteBytes);
+  return ret;
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef POLOLUJRKUSB_LIB_ADAPTIVE
+#define POLOLUJRKUSB_LIB_ADAPTIVE
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+#include "poller.h"
+
+namespace PololuJrkUSB {
+
+struct AdaptiveConfig {
+  // Period of full sampling while the motor is active
+  std::chrono::microseconds active_period = std::chrono::milliseconds(10);
+  // Longest period of the idle heartbeat (error flags only)
+  std::chrono::microseconds idle_period = std::chrono::seconds(1);
+  // How long to remain at full rate after the last sign of activity
+  std::chrono::microseconds hold = std::chrono::milliseconds(500);
+  // Growth factor of the sampling period each idle tick, up to idle_period
+  unsigned decay = 2;
+};
+
+struct AdaptiveStats {
+  uint64_t full_samples;   // full variable suites issued
+  uint64_t heartbeats;     // error-flag-only reads issued
+  uint64_t bursts;         // error flag edges which forced full rate
+  uint64_t bytes;          // bytes spent, commands plus replies
+  uint64_t baseline_bytes; // bytes constant full-rate sampling would spend
+  double seconds;          // time covered by the above
+
+  double BytesPerSecSaved() const {
+    return seconds > 0 ? (static_cast<double>(baseline_bytes) - bytes) / seconds : 0;
+  }
+};
+
+// Samples a jrk at full rate only while it's doing something. The motor is
+// considered active while its duty cycle is nonzero, and for cfg.hold after
+// its target last changed. Otherwise, the sampling period decays toward
+// cfg.idle_period, reading only the error flags. Any change in the error
+// flags forces an immediate full-rate burst.
+//
+// Replies must be routed to OnReply(), typically from the Poller's reply
+// callback. Targets should be set through SetJrkTarget() here, since
+// heartbeats won't notice target changes made behind our back.
+class AdaptivePoller {
+public:
+  AdaptivePoller(Poller& poller, const AdaptiveConfig& cfg = AdaptiveConfig());
+
+  // Issues reads until Stop(); call from its own thread. If a read can't be
+  // written (e.g. the device was lost), the error is reported on stderr and
+  // kept for Error(), and Run() returns.
+  void Run();
+  void Stop();
+  std::string Error(); // why Run() returned early, or empty
+
+  void SetJrkTarget(int target); // sets target and kicks to full rate
+  void Kick(); // sample at full rate immediately
+  void OnReply(const JrkVariable& var, int value);
+  AdaptiveStats Stats();
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  Poller& poller;
+  const AdaptiveConfig cfg;
+  std::mutex lock; // guards all below
+  std::condition_variable cv;
+  bool stopped;
+  std::string error;
+  bool kicked;
+  int lasterrors;
+  bool havetarget;
+  int lasttarget;
+  clock::time_point start;
+  clock::time_point lastactive;
+  std::chrono::microseconds period;
+  AdaptiveStats stats;
+};
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <stdexcept>
+#include "capture.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+static const unsigned char CaptureMagic[] = { 'J', 'R', 'K', 'C', 'A', 'P', };
+constexpr size_t CaptureFlushSize = 4096;
+
+CaptureWriter::CaptureWriter(const std::string& path) :
+fp(fopen(path.c_str(), "wbe")),
+last(std::chrono::steady_clock::now()) {
+  if(fp == nullptr){
+    throw std::runtime_error("couldn't open "s + path + ": " + strerror(errno));
+  }
+  buf.reserve(CaptureFlushSize + CaptureMaxPayload + 11);
+  buf.insert(buf.end(), CaptureMagic, CaptureMagic + sizeof(CaptureMagic));
+  buf.push_back(CaptureVersion);
+  buf.push_back(0);
+}
+
+CaptureWriter::~CaptureWriter() {
+  try{
+    Close();
+  }catch(std::runtime_error&){
+    // nowhere to report it; Close() first to find out
+  }
+}
+
+// Writes out buf, which is emptied even on failure
+void CaptureWriter::Write() {
+  if(fp == nullptr){
+    buf.clear();
+    return;
+  }
+  const auto n = fwrite(buf.data(), 1, buf.size(), fp);
+  const bool failed = n != buf.size();
+  buf.clear();
+  if(failed){
+    throw std::runtime_error("error writing capture: "s + strerror(errno));
+  }
+}
+
+void CaptureWriter::Flush() {
+  Write();
+  if(fp && fflush(fp)){
+    throw std::runtime_error("error writing capture: "s + strerror(errno));
+  }
+}
+
+void CaptureWriter::Close() {
+  if(fp == nullptr){
+    return;
+  }
+  std::string err;
+  try{
+    Flush();
+  }catch(std::runtime_error& e){
+    err = e.what();
+  }
+  if(fclose(fp) && err.empty()){
+    err = "error closing capture: "s + strerror(errno);
+  }
+  fp = nullptr;
+  if(!err.empty()){
+    throw std::runtime_error(err);
+  }
+}
+
+void CaptureWriter::Record(CaptureKind kind, const unsigned char* data, size_t len) {
+  do{
+    const auto now = std::chrono::steady_clock::now();
+    uint64_t delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    last = now;
+    const size_t chunk = len > CaptureMaxPayload ? CaptureMaxPayload : len;
+    buf.push_back((static_cast<unsigned char>(kind) << 6u) | chunk);
+    do{
+      buf.push_back((delta & 0x7f) | (delta > 0x7f ? 0x80 : 0));
+      delta >>= 7;
+    }while(delta);
+    buf.insert(buf.end(), data, data + chunk);
+    data += chunk;
+    len -= chunk;
+    if(buf.size() >= CaptureFlushSize){
+      Write();
+    }
+  }while(len);
+}
+
+CaptureReader::CaptureReader(const std::string& path) :
+fp(fopen(path.c_str(), "rbe")),
+elapsed(0) {
+  if(fp == nullptr){
+    throw std::runtime_error("couldn't open "s + path + ": " + strerror(errno));
+  }
+  unsigned char header[sizeof(CaptureMagic) + 2];
+  if(fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+     memcmp(header, CaptureMagic, sizeof(CaptureMagic)) ||
+     header[sizeof(CaptureMagic)] != CaptureVersion){
+    fclose(fp);
+    throw std::runtime_error(path + " is not a version "s +
+                             std::to_string(CaptureVersion) + " capture");
+  }
+}
+
+CaptureReader::~CaptureReader() {
+  fclose(fp);
+}
+
+bool CaptureReader::Next(CaptureRecord& rec) {
+  int c = getc(fp);
+  if(c == EOF){
+    return false;
+  }
+  rec.kind = static_cast<CaptureKind>(c >> 6);
+  const size_t len = c & 0x3f;
+  uint64_t delta = 0;
+  unsigned shift = 0;
+  do{
+    if((c = getc(fp)) == EOF || shift > 63){
+      throw std::runtime_error("truncated capture record");
+    }
+    delta |= static_cast<uint64_t>(c & 0x7f) << shift;
+    shift += 7;
+  }while(c & 0x80);
+  elapsed += std::chrono::nanoseconds(delta);
+  rec.when = elapsed;
+  rec.data.resize(len);
+  if(len && fread(rec.data.data(), 1, len, fp) != len){
+    throw std::runtime_error("truncated capture record");
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef POLOLUJRKUSB_LIB_CAPTURE
+#define POLOLUJRKUSB_LIB_CAPTURE
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace PololuJrkUSB {
+
+// Capture files record every byte written to and read from one device. The
+// file begins with an 8-byte header: "JRKCAP" followed by the version and a
+// reserved byte. Each record is then:
+//
+//   1 byte:  kind in the top 2 bits, payload length (0..63) in the low 6
+//   varint:  nanoseconds since the previous record (LEB128)
+//   payload: the bytes themselves
+//
+// Longer writes and reads are split across records with zero deltas.
+enum class CaptureKind : unsigned char {
+  Write = 0,  // host to jrk
+  Read = 1,   // jrk to host
+  Resync = 2, // input was drained to resynchronize; payload is what was drained
+};
+
+constexpr unsigned char CaptureVersion = 1;
+constexpr size_t CaptureMaxPayload = 63;
+
+struct CaptureRecord {
+  CaptureKind kind;
+  std::chrono::nanoseconds when; // since the start of the capture
+  std::vector<unsigned char> data;
+};
+
+class CaptureWriter {
+public:
+  explicit CaptureWriter(const std::string& path); // throws on failure
+  virtual ~CaptureWriter(); // closes, ignoring errors; see Close()
+
+  // These throw if the file can't be written
+  void Record(CaptureKind kind, const unsigned char* data, size_t len);
+  void Flush();
+  void Close(); // flushes; further records are discarded
+
+private:
+  FILE* fp; // null once closed
+  void Write();
+  std::chrono::steady_clock::time_point last;
+  std::vector<unsigned char> buf;
+};
+
+class CaptureReader {
+public:
+  explicit CaptureReader(const std::string& path); // throws on failure
+  virtual ~CaptureReader();
+
+  // Returns false at the end of the capture. Throws on a malformed file.
+  bool Next(CaptureRecord& rec);
+
+private:
+  FILE* fp;
+  std::chrono::nanoseconds elapsed;
+};
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "config.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+static const char ConfigMagic[] = { 'J', 'R', 'K', 'C', 'F', 'G', };
+
+// Params must be listed in EEPROM order for grouping to find neighbours
+static constexpr bool ConfigParamsOrdered() {
+  for(size_t i = 1 ; i < JrkConfigParamCount ; ++i){
+    if(static_cast<unsigned>(JrkConfigParams[i - 1].id) + JrkConfigParams[i - 1].bytes >
+       static_cast<unsigned>(JrkConfigParams[i].id)){
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(ConfigParamsOrdered(), "JrkConfigParams[] must be in EEPROM order");
+
+// A param marked as pairing must abut the next, within one transfer
+static constexpr bool ConfigPairsAdjacent() {
+  for(size_t i = 0 ; i < JrkConfigParamCount ; ++i){
+    if(JrkConfigParams[i].pairs &&
+       (i + 1 == JrkConfigParamCount ||
+        static_cast<unsigned>(JrkConfigParams[i].id) + JrkConfigParams[i].bytes !=
+        static_cast<unsigned>(JrkConfigParams[i + 1].id) ||
+        JrkConfigParams[i].bytes + JrkConfigParams[i + 1].bytes > JrkConfigTransferMax)){
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(ConfigPairsAdjacent(), "JrkConfigParams[] pairs must be adjacent");
+
+std::vector<JrkConfigTransfer> JrkConfigGroup(const std::vector<size_t>& params,
+                                              unsigned maxbytes) {
+  std::vector<JrkConfigTransfer> transfers;
+  for(auto idx : params){
+    const auto& p = JrkConfigParams[idx];
+    const unsigned offset = static_cast<unsigned>(p.id);
+    if(!transfers.empty()){
+      auto& t = transfers.back();
+      if(t.first + t.count == idx && JrkConfigParams[idx - 1].pairs &&
+         t.offset + t.bytes == offset && t.bytes + p.bytes <= maxbytes){
+        t.bytes += p.bytes;
+        ++t.count;
+        continue;
+      }
+    }
+    transfers.push_back(JrkConfigTransfer{ offset, p.bytes, idx, 1, });
+  }
+  return transfers;
+}
+
+JrkConfigSnapshot::JrkConfigSnapshot() :
+values() {
+}
+
+unsigned JrkConfigSnapshot::Get(JrkConfigParam id) const {
+  const auto idx = JrkConfigIndex(id);
+  if(idx == JrkConfigParamCount){
+    throw std::invalid_argument("unknown parameter "s + std::to_string(static_cast<int>(id)));
+  }
+  return values[idx];
+}
+
+void JrkConfigSnapshot::Set(JrkConfigParam id, unsigned value) {
+  const auto idx = JrkConfigIndex(id);
+  if(idx == JrkConfigParamCount){
+    throw std::invalid_argument("unknown parameter "s + std::to_string(static_cast<int>(id)));
+  }
+  if(value >= 1u << (8 * JrkConfigParams[idx].bytes)){
+    throw std::invalid_argument("value "s + std::to_string(value) + " too wide for " +
+                                JrkConfigParams[idx].name);
+  }
+  values[idx] = value;
+}
+
+std::vector<size_t> JrkConfigSnapshot::Differences(const JrkConfigSnapshot& other) const {
+  std::vector<size_t> diffs;
+  for(size_t i = 0 ; i < JrkConfigParamCount ; ++i){
+    if(values[i] != other.values[i]){
+      diffs.push_back(i);
+    }
+  }
+  return diffs;
+}
+
+unsigned JrkConfigSnapshot::Pack(const JrkConfigTransfer& t) const {
+  unsigned packed = 0;
+  unsigned shift = 0;
+  for(size_t i = t.first ; i < t.first + t.count ; ++i){
+    packed |= static_cast<unsigned>(values[i]) << shift;
+    shift += 8 * JrkConfigParams[i].bytes;
+  }
+  return packed;
+}
+
+void JrkConfigSnapshot::Unpack(const JrkConfigTransfer& t, const unsigned char* data) {
+  for(size_t i = t.first ; i < t.first + t.count ; ++i){
+    values[i] = data[0] | (JrkConfigParams[i].bytes == 2 ? data[1] << 8u : 0);
+    data += JrkConfigParams[i].bytes;
+  }
+}
+
+void JrkConfigSnapshot::WriteBinary(std::ostream& s) const {
+  s.write(ConfigMagic, sizeof(ConfigMagic));
+  s.put(JrkConfigVersion);
+  s.put(JrkConfigParamCount);
+  for(size_t i = 0 ; i < JrkConfigParamCount ; ++i){
+    s.put(static_cast<char>(JrkConfigParams[i].id));
+    s.put(values[i] & 0xff);
+    if(JrkConfigParams[i].bytes == 2){
+      s.put(values[i] >> 8u);
+    }
+  }
+}
+
+void JrkConfigSnapshot::ReadBinary(std::istream& s) {
+  char header[sizeof(ConfigMagic) + 2];
+  if(!s.read(header, sizeof(header)) || memcmp(header, ConfigMagic, sizeof(ConfigMagic)) ||
+     header[sizeof(ConfigMagic)] != JrkConfigVersion){
+    throw std::runtime_error("not a version "s + std::to_string(JrkConfigVersion) +
+                             " config snapshot");
+  }
+  const unsigned count = static_cast<unsigned char>(header[sizeof(ConfigMagic) + 1]);
+  std::array<bool, JrkConfigParamCount> seen{};
+  JrkConfigSnapshot read;
+  for(unsigned n = 0 ; n < count ; ++n){
+    int id = s.get();
+    if(id == EOF){
+      throw std::runtime_error("truncated config snapshot");
+    }
+    const auto idx = JrkConfigIndex(static_cast<JrkConfigParam>(id));
+    if(idx == JrkConfigParamCount){
+      throw std::runtime_error("unknown parameter "s + std::to_string(id) + " in config snapshot");
+    }
+    unsigned char data[2] = { 0, 0, };
+    if(!s.read(reinterpret_cast<char*>(data), JrkConfigParams[idx].bytes)){
+      throw std::runtime_error("truncated config snapshot");
+    }
+    read.Unpack(JrkConfigTransfer{ static_cast<unsigned>(id), JrkConfigParams[idx].bytes, idx, 1, }, data);
+    seen[idx] = true;
+  }
+  for(size_t i = 0 ; i < JrkConfigParamCount ; ++i){
+    if(!seen[i]){
+      throw std::runtime_error("config snapshot lacks "s + JrkConfigParams[i].name);
+    }
+  }
+  values = read.values;
+}
+
+void JrkConfigSnapshot::WriteText(std::ostream& s) const {
+  s << "# jrk config snapshot v" << static_cast<unsigned>(JrkConfigVersion) << "\n";
+  for(size_t i = 0 ; i < JrkConfigParamCount ; ++i){
+    s << JrkConfigParams[i].name << ' ' << values[i] << "\n";
+  }
+}
+
+void JrkConfigSnapshot::ReadText(std::istream& s) {
+  JrkConfigSnapshot read(*this);
+  std::string line;
+  unsigned lineno = 0;
+  while(std::getline(s, line)){
+    ++lineno;
+    line.erase(std::min(line.find('#'), line.size()));
+    std::istringstream fields(line);
+    std::string name, extra;
+    long value;
+    if(!(fields >> name)){
+      continue; // blank, or only a comment
+    }
+    if(!(fields >> value) || (fields >> extra)){
+      throw std::runtime_error("line "s + std::to_string(lineno) + ": expected \"name value\"");
+    }
+    size_t idx = 0;
+    while(idx < JrkConfigParamCount && name != JrkConfigParams[idx].name){
+      ++idx;
+    }
+    if(idx == JrkConfigParamCount){
+      throw std::runtime_error("line "s + std::to_string(lineno) + ": unknown parameter " + name);
+    }
+    if(value < 0 || value >= 1l << (8 * JrkConfigParams[idx].bytes)){
+      throw std::runtime_error("line "s + std::to_string(lineno) + ": " + name +
+                               " out of range");
+    }
+    read.values[idx] = value;
+  }
+  values = read.values;
+}
+
+}
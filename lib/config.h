@@ -0,0 +1,152 @@
+#ifndef POLOLUJRKUSB_LIB_CONFIG
+#define POLOLUJRKUSB_LIB_CONFIG
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include "protocol.h"
+
+namespace PololuJrkUSB {
+
+// Every persistent parameter, in EEPROM order; a parameter's id is its
+// offset. Booleans occupy a byte. PARAMETER_INITIALIZED is left out, since
+// writing it restores the factory defaults.
+struct JrkConfigParamInfo {
+  JrkConfigParam id;
+  unsigned bytes;
+  const char* name; // as used in text snapshots
+  // Whether one transfer may cover this param and the next. Only the pairs
+  // protocol.h marks as consecutive in EEPROM are known to be safe; other
+  // neighbours, e.g. booleans, are written alone.
+  bool pairs = false;
+};
+
+constexpr JrkConfigParamInfo JrkConfigParams[] = {
+  { JrkConfigParam::PARAMETER_INPUT_MODE, 1, "input_mode", },
+  { JrkConfigParam::PARAMETER_INPUT_MINIMUM, 2, "input_minimum", },
+  { JrkConfigParam::PARAMETER_INPUT_MAXIMUM, 2, "input_maximum", },
+  { JrkConfigParam::PARAMETER_OUTPUT_MINIMUM, 2, "output_minimum", },
+  { JrkConfigParam::PARAMETER_OUTPUT_NEUTRAL, 2, "output_neutral", },
+  { JrkConfigParam::PARAMETER_OUTPUT_MAXIMUM, 2, "output_maximum", },
+  { JrkConfigParam::PARAMETER_INPUT_INVERT, 1, "input_invert", },
+  { JrkConfigParam::PARAMETER_INPUT_SCALING_DEGREE, 1, "input_scaling_degree", },
+  { JrkConfigParam::PARAMETER_INPUT_POWER_WITH_AUX, 1, "input_power_with_aux", },
+  { JrkConfigParam::PARAMETER_INPUT_ANALOG_SAMPLES_EXPONENT, 1, "input_analog_samples_exponent", },
+  { JrkConfigParam::PARAMETER_INPUT_DISCONNECT_MINIMUM, 2, "input_disconnect_minimum", },
+  { JrkConfigParam::PARAMETER_INPUT_DISCONNECT_MAXIMUM, 2, "input_disconnect_maximum", },
+  { JrkConfigParam::PARAMETER_INPUT_NEUTRAL_MAXIMUM, 2, "input_neutral_maximum", },
+  { JrkConfigParam::PARAMETER_INPUT_NEUTRAL_MINIMUM, 2, "input_neutral_minimum", },
+  { JrkConfigParam::PARAMETER_SERIAL_MODE, 1, "serial_mode", },
+  { JrkConfigParam::PARAMETER_SERIAL_FIXED_BAUD_RATE, 2, "serial_fixed_baud_rate", },
+  { JrkConfigParam::PARAMETER_SERIAL_TIMEOUT, 2, "serial_timeout", },
+  { JrkConfigParam::PARAMETER_SERIAL_ENABLE_CRC, 1, "serial_enable_crc", },
+  { JrkConfigParam::PARAMETER_SERIAL_NEVER_SUSPEND, 1, "serial_never_suspend", },
+  { JrkConfigParam::PARAMETER_SERIAL_DEVICE_NUMBER, 1, "serial_device_number", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_MODE, 1, "feedback_mode", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_MINIMUM, 2, "feedback_minimum", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_MAXIMUM, 2, "feedback_maximum", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_INVERT, 1, "feedback_invert", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_POWER_WITH_AUX, 1, "feedback_power_with_aux", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_DEAD_ZONE, 1, "feedback_dead_zone", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_ANALOG_SAMPLES_EXPONENT, 1, "feedback_analog_samples_exponent", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_DISCONNECT_MINIMUM, 2, "feedback_disconnect_minimum", },
+  { JrkConfigParam::PARAMETER_FEEDBACK_DISCONNECT_MAXIMUM, 2, "feedback_disconnect_maximum", },
+  { JrkConfigParam::PARAMETER_PROPORTIONAL_MULTIPLIER, 2, "proportional_multiplier", },
+  { JrkConfigParam::PARAMETER_PROPORTIONAL_EXPONENT, 1, "proportional_exponent", },
+  { JrkConfigParam::PARAMETER_INTEGRAL_MULTIPLIER, 2, "integral_multiplier", },
+  { JrkConfigParam::PARAMETER_INTEGRAL_EXPONENT, 1, "integral_exponent", },
+  { JrkConfigParam::PARAMETER_DERIVATIVE_MULTIPLIER, 2, "derivative_multiplier", },
+  { JrkConfigParam::PARAMETER_DERIVATIVE_EXPONENT, 1, "derivative_exponent", },
+  { JrkConfigParam::PARAMETER_PID_PERIOD, 2, "pid_period", },
+  { JrkConfigParam::PARAMETER_PID_INTEGRAL_LIMIT, 2, "pid_integral_limit", },
+  { JrkConfigParam::PARAMETER_PID_RESET_INTEGRAL, 1, "pid_reset_integral", },
+  { JrkConfigParam::PARAMETER_MOTOR_PWM_FREQUENCY, 1, "motor_pwm_frequency", },
+  { JrkConfigParam::PARAMETER_MOTOR_INVERT, 1, "motor_invert", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_DUTY_CYCLE_WHILE_FEEDBACK_OUT_OF_RANGE, 2, "motor_max_duty_cycle_while_feedback_out_of_range", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_ACCELERATION_FORWARD, 2, "motor_max_acceleration_forward", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_ACCELERATION_REVERSE, 2, "motor_max_acceleration_reverse", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_DUTY_CYCLE_FORWARD, 2, "motor_max_duty_cycle_forward", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_DUTY_CYCLE_REVERSE, 2, "motor_max_duty_cycle_reverse", },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_CURRENT_FORWARD, 1, "motor_max_current_forward", true, },
+  { JrkConfigParam::PARAMETER_MOTOR_MAX_CURRENT_REVERSE, 1, "motor_max_current_reverse", },
+  { JrkConfigParam::PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD, 1, "motor_current_calibration_forward", true, },
+  { JrkConfigParam::PARAMETER_MOTOR_CURRENT_CALIBRATION_REVERSE, 1, "motor_current_calibration_reverse", },
+  { JrkConfigParam::PARAMETER_MOTOR_BRAKE_DURATION_FORWARD, 1, "motor_brake_duration_forward", },
+  { JrkConfigParam::PARAMETER_MOTOR_BRAKE_DURATION_REVERSE, 1, "motor_brake_duration_reverse", },
+  { JrkConfigParam::PARAMETER_MOTOR_COAST_WHEN_OFF, 1, "motor_coast_when_off", },
+  { JrkConfigParam::PARAMETER_ERROR_ENABLE, 2, "error_enable", },
+  { JrkConfigParam::PARAMETER_ERROR_LATCH, 2, "error_latch", },
+};
+
+constexpr size_t JrkConfigParamCount = sizeof(JrkConfigParams) / sizeof(*JrkConfigParams);
+
+// Index of id in JrkConfigParams[], or JrkConfigParamCount if it's absent
+constexpr size_t JrkConfigIndex(JrkConfigParam id) {
+  size_t i = 0;
+  while(i < JrkConfigParamCount && JrkConfigParams[i].id != id){
+    ++i;
+  }
+  return i;
+}
+
+// A parameter control transfer carries its value in wValue, so at most two
+// bytes of EEPROM are written at once.
+constexpr unsigned JrkConfigTransferMax = 2;
+
+// One control transfer, covering the params JrkConfigParams[first] through
+// JrkConfigParams[first + count - 1], which are contiguous in EEPROM.
+struct JrkConfigTransfer {
+  unsigned offset; // of the first byte
+  unsigned bytes;
+  size_t first;
+  size_t count;
+};
+
+// Groups the params at the given (ascending) indices into as few transfers
+// of at most maxbytes as contiguity allows, merging only params marked as
+// pairs with their successors. A param is never split.
+std::vector<JrkConfigTransfer> JrkConfigGroup(const std::vector<size_t>& params,
+                                              unsigned maxbytes = JrkConfigTransferMax);
+
+// Snapshots are written in binary as "JRKCFG", the version, and the number
+// of params, followed by each param's id (one byte) and value (little
+// endian, in the param's width). The text form has one "name value" line per
+// param; '#' starts a comment.
+constexpr unsigned char JrkConfigVersion = 1;
+
+// The value of every param in JrkConfigParams[]
+class JrkConfigSnapshot {
+public:
+  JrkConfigSnapshot(); // all zeroes
+
+  unsigned Get(JrkConfigParam id) const;
+  void Set(JrkConfigParam id, unsigned value); // throws std::invalid_argument
+
+  // Indices of the params whose values differ in other, ascending
+  std::vector<size_t> Differences(const JrkConfigSnapshot& other) const;
+
+  // The wValue of a transfer writing t, and the inverse for t's reply
+  unsigned Pack(const JrkConfigTransfer& t) const;
+  void Unpack(const JrkConfigTransfer& t, const unsigned char* data);
+
+  // Reading throws std::runtime_error on malformed input. A binary snapshot
+  // must name every param; a text snapshot sets only those it names, so it
+  // can be applied on top of an exported snapshot.
+  void WriteBinary(std::ostream& s) const;
+  void ReadBinary(std::istream& s);
+  void WriteText(std::ostream& s) const;
+  void ReadText(std::istream& s);
+
+  bool operator==(const JrkConfigSnapshot& other) const {
+    return values == other.values;
+  }
+
+private:
+  std::array<uint16_t, JrkConfigParamCount> values;
+};
+
+}
+
+#endif
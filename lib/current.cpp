@@ -0,0 +1,69 @@
+#include <cmath>
+#include <algorithm>
+#include "current.h"
+
+namespace PololuJrkUSB {
+
+const char* CurrentTripName(CurrentTrip t) {
+  switch(t){
+    case CurrentTrip::None: return "none";
+    case CurrentTrip::Overcurrent: return "overcurrent";
+    case CurrentTrip::I2t: return "I2t";
+  }
+  return "unknown";
+}
+
+CurrentMonitor::CurrentMonitor(const JrkCurrentCalibration& cal,
+                               const CurrentMonitorConfig& cfg,
+                               std::chrono::microseconds period) :
+cal(cal),
+cfg(cfg),
+budget(std::pow(cfg.rated_ma / 1000.0, 2) *
+       std::chrono::duration<double>(cfg.window).count()),
+slices(cfg.window / std::max(period, std::chrono::microseconds(1)) + 2),
+energy(0),
+sampled(false),
+lastma(0),
+trip(CurrentTrip::None) {
+}
+
+CurrentTrip CurrentMonitor::Sample(int raw, int dutycycle, clock::time_point when) {
+  lastma = cal.Milliamps(raw, dutycycle);
+  if(sampled){
+    const double amps = lastma / 1000.0;
+    slices.PushBack(Slice{ when, amps * amps * std::chrono::duration<double>(when - last).count(), });
+    energy += slices.Back().energy;
+  }
+  sampled = true;
+  last = when;
+  while(!slices.Empty() && slices.Front().when <= when - cfg.window){
+    energy -= slices.Front().energy;
+    slices.PopFront();
+  }
+  if(slices.Empty()){
+    energy = 0; // shed any accumulated rounding error
+  }
+  if(trip != CurrentTrip::None){
+    return CurrentTrip::None;
+  }
+  if(cfg.overcurrent_ma && lastma > cfg.overcurrent_ma){
+    trip = CurrentTrip::Overcurrent;
+  }else if(cfg.rated_ma && energy > budget){
+    trip = CurrentTrip::I2t;
+  }
+  return trip;
+}
+
+double CurrentMonitor::RmsMilliamps() const {
+  return 1000 * std::sqrt(std::max(energy, 0.0) /
+                          std::chrono::duration<double>(cfg.window).count());
+}
+
+void CurrentMonitor::Reset() {
+  slices.Clear();
+  energy = 0;
+  lastma = 0;
+  trip = CurrentTrip::None;
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef POLOLUJRKUSB_LIB_CURRENT
+#define POLOLUJRKUSB_LIB_CURRENT
+
+#include <chrono>
+#include <cstdint>
+#include "ring.h"
+
+namespace PololuJrkUSB {
+
+// The jrk reports motor current in units set by its calibration parameters,
+// PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD and _REVERSE, each in mA per
+// unit. Its own current limits, PARAMETER_MOTOR_MAX_CURRENT_FORWARD and
+// _REVERSE, are in those same units (0 means no limit). See
+// JrkGetCurrentCalibration().
+struct JrkCurrentCalibration {
+  unsigned forward;
+  unsigned reverse;
+  unsigned maxforward;
+  unsigned maxreverse;
+
+  // The current reading is unsigned; the duty cycle's sign gives direction.
+  unsigned Milliamps(int raw, int dutycycle) const {
+    return static_cast<unsigned>(raw) * (dutycycle < 0 ? reverse : forward);
+  }
+};
+
+struct CurrentMonitorConfig {
+  // Trips on any sample above this; 0 disables.
+  unsigned overcurrent_ma = 0;
+  // Trips once the integral of current squared over the trailing window
+  // exceeds that of rated_ma held for the whole window, i.e. when the RMS
+  // current over the window exceeds rated_ma. Time before monitoring began
+  // counts as zero current. 0 disables.
+  unsigned rated_ma = 0;
+  std::chrono::milliseconds window{1000};
+};
+
+enum class CurrentTrip : unsigned char {
+  None,
+  Overcurrent,
+  I2t,
+};
+
+const char* CurrentTripName(CurrentTrip t);
+
+// Overcurrent and I²t detection over a stream of current samples. Samples
+// are held in a ring of the window's length, sized at construction for the
+// expected sample period, so steady operation allocates nothing. Once
+// tripped, the monitor stays tripped until Reset(). Not thread safe.
+class CurrentMonitor {
+public:
+  using clock = std::chrono::steady_clock;
+
+  CurrentMonitor(const JrkCurrentCalibration& cal, const CurrentMonitorConfig& cfg,
+                 std::chrono::microseconds period);
+
+  // Records a raw current reading taken at when, with the duty cycle read
+  // just before it. Each sample is taken to have held since the previous
+  // one. Returns the trip, if this sample is the one which tripped.
+  CurrentTrip Sample(int raw, int dutycycle, clock::time_point when);
+
+  CurrentTrip Tripped() const {
+    return trip;
+  }
+  unsigned LastMilliamps() const {
+    return lastma;
+  }
+  double RmsMilliamps() const; // over the trailing window
+
+  // Rearms, forgetting the window. The next sample still counts from the
+  // last, as if current had been zero until then.
+  void Reset();
+
+private:
+  struct Slice {
+    clock::time_point when;
+    double energy; // A²s since the previous sample
+  };
+
+  const JrkCurrentCalibration cal;
+  const CurrentMonitorConfig cfg;
+  const double budget; // A²s of rated_ma held for the window
+  Ring<Slice> slices; // within the window, oldest first
+  double energy; // sum of slices
+  clock::time_point last;
+  bool sampled;
+  unsigned lastma;
+  CurrentTrip trip;
+};
+
+}
+
+#endif
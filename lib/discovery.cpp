@@ -0,0 +1,215 @@
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "discovery.h"
+#include "poller.h"
+#include "usb.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+static bool IsJrk(const libusb_device_descriptor& desc) {
+  return desc.idVendor == PololuVendorID &&
+    (desc.idProduct == Jrk21v3ProductID || desc.idProduct == Jrk12v12ProductID);
+}
+
+// One device per line, tab-separated:
+// serial topology tty fwmajor fwminor confighash description
+// with the firmware version space-separated, and the hash in hex.
+void DiscoveryCache::Load(const std::string& path) {
+  std::ifstream in(path);
+  std::string line;
+  while(std::getline(in, line)){
+    std::istringstream fields(line);
+    JrkDeviceInfo info{};
+    if(std::getline(fields, info.serial, '\t') &&
+       std::getline(fields, info.topology, '\t') &&
+       std::getline(fields, info.tty, '\t') &&
+       (fields >> info.fwmajor >> info.fwminor) &&
+       fields.get() == '\t' &&
+       (fields >> std::hex >> info.confighash) &&
+       fields.get() == '\t' &&
+       std::getline(fields, info.description) &&
+       info.description.find('\t') == std::string::npos){ // not an older format
+      entries[info.serial] = info;
+    }
+  }
+}
+
+void DiscoveryCache::Save(const std::string& path) const {
+  auto tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp);
+    for(const auto& e : entries){
+      const auto& info = e.second;
+      out << info.serial << '\t' << info.topology << '\t' << info.tty << '\t'
+          << info.fwmajor << ' ' << info.fwminor << '\t'
+          << std::hex << info.confighash << std::dec << '\t' << info.description << '\n';
+    }
+    if(!out){
+      throw std::runtime_error("error writing "s + tmp);
+    }
+  }
+  if(rename(tmp.c_str(), path.c_str())){
+    throw std::runtime_error("error renaming "s + tmp + ": " + strerror(errno));
+  }
+}
+
+const JrkDeviceInfo* DiscoveryCache::Lookup(const std::string& serial) const {
+  auto it = entries.find(serial);
+  return it == entries.end() ? nullptr : &it->second;
+}
+
+void DiscoveryCache::Update(const JrkDeviceInfo& info) {
+  auto& e = entries[info.serial];
+  e = info;
+  e.config.clear();
+  e.warm = false;
+}
+
+std::string DefaultDiscoveryCachePath() {
+  std::string dir;
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if(xdg && *xdg){
+    dir = xdg;
+  }else if(home && *home){
+    dir = home + "/.cache"s;
+  }else{
+    return "";
+  }
+  mkdir(dir.c_str(), 0755); // if it exists, fine; if not, Save() reports it
+  return dir + "/pololujrkusb";
+}
+
+JrkDeviceInfo ProbeJrk(libusb_device* dev, const libusb_device_descriptor& desc,
+                       const DiscoveryCache* cache, bool dumpconfig) {
+  JrkDeviceInfo info{};
+  info.topology = LibusbGetTopology(dev);
+  try{
+    info.tty = FindACMDevice(info.topology);
+  }catch(std::runtime_error&){ // FIXME clamp down on acceptable errors
+    info.tty.clear();
+  }
+  // bcdDevice is the firmware version, and libusb already has it
+  JrkFirmwareFromBcd(desc.bcdDevice, &info.fwmajor, &info.fwminor);
+  if(cache && desc.iSerialNumber){
+    info.serial = SysfsSerialNumber(info.topology);
+    const JrkDeviceInfo* cached = info.serial.empty() ? nullptr : cache->Lookup(info.serial);
+    if(cached && cached->topology == info.topology && cached->tty == info.tty &&
+       cached->fwmajor == info.fwmajor && cached->fwminor == info.fwminor){
+      info.description = cached->description;
+      info.confighash = cached->confighash;
+      info.warm = true;
+      if(!dumpconfig){
+        return info;
+      }
+    }
+  }
+  libusb_device_handle* handle;
+  auto ret = libusb_open(dev, &handle);
+  if(ret){
+    throw std::runtime_error("error opening usb device "s + info.topology + ": " +
+                             libusb_strerror(static_cast<libusb_error>(ret)));
+  }
+  try{
+    if(info.serial.empty()){
+      info.serial = JrkGetSerialNumber(handle, &desc);
+    }
+    if(!info.warm){
+      std::ostringstream desctext;
+      LibusbGetDesc(desctext, handle, &desc);
+      info.description = desctext.str();
+      info.description.erase(std::remove(info.description.begin(),
+                                         info.description.end(), '\n'),
+                             info.description.end());
+    }
+    std::ostringstream config;
+    info.confighash = LibusbGetConfig(config, handle);
+    info.config = config.str();
+  }catch(...){
+    libusb_close(handle);
+    throw;
+  }
+  libusb_close(handle);
+  return info;
+}
+
+DiscoveryReport DiscoverJrks(libusb_context* ctx, const std::string& cachepath,
+                             bool dumpconfig) {
+  const auto start = std::chrono::steady_clock::now();
+  DiscoveryCache cache;
+  if(!cachepath.empty()){
+    cache.Load(cachepath);
+  }
+  libusb_device** list;
+  auto count = libusb_get_device_list(ctx, &list);
+  if(count < 0){
+    throw std::runtime_error("error listing usb devices: "s +
+                             libusb_strerror(static_cast<libusb_error>(count)));
+  }
+  struct Probe {
+    libusb_device* dev;
+    libusb_device_descriptor desc;
+    JrkDeviceInfo info;
+    std::string error;
+  };
+  std::vector<Probe> probes;
+  for(ssize_t i = 0 ; i < count ; ++i){
+    Probe p{};
+    p.dev = list[i];
+    // device descriptors are cached by libusb; this involves no I/O
+    if(libusb_get_device_descriptor(p.dev, &p.desc) == 0 && IsJrk(p.desc)){
+      probes.push_back(p);
+    }
+  }
+  std::vector<std::thread> threads;
+  for(auto& p : probes){
+    threads.emplace_back([&p, &cache, dumpconfig](){
+      try{
+        p.info = ProbeJrk(p.dev, p.desc, &cache, dumpconfig);
+      }catch(std::runtime_error& e){
+        p.error = e.what();
+      }
+    });
+  }
+  for(auto& t : threads){
+    t.join();
+  }
+  libusb_free_device_list(list, 1);
+
+  DiscoveryReport report{};
+  for(auto& p : probes){
+    if(p.error.empty()){
+      report.warm += p.info.warm;
+      if(!p.info.serial.empty()){
+        cache.Update(p.info);
+      }
+      report.devices.emplace_back(std::move(p.info));
+    }else{
+      report.errors.emplace_back(std::move(p.error));
+    }
+  }
+  std::sort(report.devices.begin(), report.devices.end(),
+            [](const JrkDeviceInfo& a, const JrkDeviceInfo& b){
+              return a.topology < b.topology;
+            });
+  report.elapsed = std::chrono::steady_clock::now() - start;
+  if(!cachepath.empty()){
+    try{
+      cache.Save(cachepath);
+    }catch(std::runtime_error& e){
+      std::cerr << "couldn't save discovery cache: " << e.what() << std::endl;
+    }
+  }
+  return report;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef POLOLUJRKUSB_LIB_DISCOVERY
+#define POLOLUJRKUSB_LIB_DISCOVERY
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <libusb.h>
+
+namespace PololuJrkUSB {
+
+struct JrkDeviceInfo {
+  std::string serial;
+  std::string topology;    // e.g. "1-2.4.1", see LibusbGetTopology()
+  std::string tty;         // name under /dev, or empty if none was found
+  std::string description; // vendor/product line from LibusbGetDesc()
+  std::string config;      // config dump; empty if taken from the cache
+  int fwmajor;
+  int fwminor;
+  uint32_t confighash;     // see LibusbGetConfig(); as of the last dump
+  bool warm;               // description taken from the cache
+};
+
+// Maps serial numbers to what we learned about each device last time: its
+// description, which can't change without the firmware changing, and the
+// hash of its config as last dumped. A cached entry is trusted only if the
+// device still has the same serial number at the same topology path, the
+// same tty is still bound to it, and it reports the same firmware version.
+// The config can be changed over USB at any time, so a cached hash is only
+// as fresh as the last dump; ask for a dump to refresh it.
+class DiscoveryCache {
+public:
+  void Load(const std::string& path); // a missing file is an empty cache
+  void Save(const std::string& path) const; // throws on failure
+  const JrkDeviceInfo* Lookup(const std::string& serial) const;
+  void Update(const JrkDeviceInfo& info);
+
+private:
+  std::map<std::string, JrkDeviceInfo> entries;
+};
+
+// $XDG_CACHE_HOME/pololujrkusb, falling back to ~/.cache/pololujrkusb.
+// Returns an empty string if neither is known.
+std::string DefaultDiscoveryCachePath();
+
+// Probes a single jrk. With a cache, a warm probe is validated from sysfs
+// and the device descriptor libusb already holds, costing no device I/O;
+// the config is dumped only on a miss, or with dumpconfig. Throws on
+// failure.
+JrkDeviceInfo ProbeJrk(libusb_device* dev, const libusb_device_descriptor& desc,
+                       const DiscoveryCache* cache, bool dumpconfig = false);
+
+struct DiscoveryReport {
+  std::vector<JrkDeviceInfo> devices; // sorted by topology
+  std::vector<std::string> errors;    // one per device which failed to probe
+  std::chrono::nanoseconds elapsed;   // time until all devices were ready
+  unsigned warm;                      // devices validated from the cache
+};
+
+// Probes every attached jrk concurrently, one thread per device. If
+// cachepath is nonempty, the cache there is consulted and then rewritten.
+DiscoveryReport DiscoverJrks(libusb_context* ctx, const std::string& cachepath,
+                             bool dumpconfig = false);
+
+}
+
+#endif
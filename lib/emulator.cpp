@@ -0,0 +1,252 @@
+#include <cmath>
+#include <poll.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <termios.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include "emulator.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+constexpr double SlewPerMs = 2.0; // feedback counts per millisecond
+constexpr unsigned JrkErrorTimeoutRX = 1u << 12;
+
+JrkEmulator::JrkEmulator() :
+masterfd(-1),
+slavefd(-1),
+cancelfd(-1),
+rxbytes(0),
+stops(0),
+laststop(0),
+servicetime(0),
+serialtimeouts(0),
+target(2048),
+feedback(2048),
+off(true),
+errors(0),
+current(-1),
+updated(std::chrono::steady_clock::now()),
+pendingtarget(-1),
+dropbytes(0),
+serialtimeout(0),
+lastrx(updated) {
+  outbuf.reserve(64);
+  masterfd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(masterfd < 0){
+    throw std::runtime_error("couldn't open pty: "s + strerror(errno));
+  }
+  char name[64];
+  if(grantpt(masterfd) || unlockpt(masterfd) || ptsname_r(masterfd, name, sizeof(name))){
+    close(masterfd);
+    throw std::runtime_error("couldn't prepare pty: "s + strerror(errno));
+  }
+  path = name;
+  slavefd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(slavefd < 0){
+    close(masterfd);
+    throw std::runtime_error("couldn't open "s + name + ": " + strerror(errno));
+  }
+  struct termios term;
+  if(tcgetattr(slavefd, &term) == 0){
+    cfmakeraw(&term);
+    tcsetattr(slavefd, TCSANOW, &term);
+  }
+  cancelfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(cancelfd < 0){
+    close(slavefd);
+    close(masterfd);
+    throw std::runtime_error("couldn't open eventfd: "s + strerror(errno));
+  }
+  thread = std::thread(&JrkEmulator::Run, this);
+}
+
+JrkEmulator::~JrkEmulator() {
+  uint64_t events = 1;
+  if(::write(cancelfd, &events, sizeof(events)) < 0){
+    std::cerr << "error cancelling emulator: " << strerror(errno) << std::endl;
+  }
+  thread.join();
+  close(cancelfd);
+  close(slavefd);
+  close(masterfd);
+}
+
+void JrkEmulator::InjectErrors(unsigned bits) {
+  std::lock_guard<std::mutex> guard(lock);
+  errors |= bits;
+}
+
+void JrkEmulator::InjectCurrent(int raw) {
+  std::lock_guard<std::mutex> guard(lock);
+  current = raw > 0xff ? 0xff : raw; // a single-byte reply
+}
+
+void JrkEmulator::SetServiceTime(std::chrono::microseconds t) {
+  servicetime = t.count();
+}
+
+void JrkEmulator::SetSerialTimeout(std::chrono::milliseconds t) {
+  std::lock_guard<std::mutex> guard(lock);
+  serialtimeout = t;
+  lastrx = std::chrono::steady_clock::now();
+}
+
+void JrkEmulator::DropReplyBytes(unsigned n) {
+  std::lock_guard<std::mutex> guard(lock);
+  dropbytes += n;
+}
+
+void JrkEmulator::Advance(std::chrono::steady_clock::time_point now) {
+  double ms = std::chrono::duration<double, std::milli>(now - updated).count();
+  updated = now;
+  if(off){
+    return;
+  }
+  double step = SlewPerMs * ms;
+  if(std::fabs(target - feedback) <= step){
+    feedback = target;
+  }else{
+    feedback += target > feedback ? step : -step;
+  }
+}
+
+int JrkEmulator::DutyCycle() const {
+  if(off){
+    return 0;
+  }
+  int duty = static_cast<int>(std::lround((target - feedback) * 2));
+  return duty > 600 ? 600 : duty < -600 ? -600 : duty;
+}
+
+int JrkEmulator::Value(JrkVar var) {
+  switch(var){
+    case JrkVar::Input: return target;
+    case JrkVar::Target: return target;
+    case JrkVar::Feedback: return static_cast<int>(feedback);
+    case JrkVar::ScaledFeedback: return static_cast<int>(feedback);
+    case JrkVar::ErrorSum: return 0;
+    case JrkVar::DutyCycleTarget: return DutyCycle();
+    case JrkVar::DutyCycle: return DutyCycle();
+    case JrkVar::Current:
+      if(current >= 0 && !off){
+        return current;
+      }
+      return std::abs(DutyCycle()) / 4;
+    case JrkVar::PIDCount: return 0;
+    case JrkVar::Errors: {
+      int e = errors; // reading error flags clears latched bits
+      errors = 0;
+      return e;
+    }
+  }
+  return 0;
+}
+
+// Called with lock held
+void JrkEmulator::Handle(unsigned char byte) {
+  const auto now = std::chrono::steady_clock::now();
+  if(serialtimeout.count() && now - lastrx > serialtimeout){
+    errors |= JrkErrorTimeoutRX;
+    ++serialtimeouts;
+  }
+  lastrx = now;
+  if(pendingtarget >= 0){
+    target = (pendingtarget & 0x1f) + ((byte & 0x7f) << 5);
+    pendingtarget = -1;
+    off = false;
+    return;
+  }
+  if((byte & 0xe0) == JRKCMD_SET_TARGET){
+    pendingtarget = byte;
+    return;
+  }
+  if(byte == JRKCMD_MOTOR_OFF){
+    off = true;
+    laststop = std::chrono::steady_clock::now().time_since_epoch().count();
+    ++stops;
+    return;
+  }
+  auto idx = JrkOpcodeIndex[byte];
+  if(idx == JrkNoVariable){
+    return; // the jrk ignores unknown commands, setting SerialProto
+  }
+  const auto& v = JrkVariables[idx];
+  unsigned val = Value(v.id);
+  for(unsigned b = 0 ; b < v.width ; ++b){
+    if(dropbytes){
+      --dropbytes;
+    }else{
+      outbuf.push_back((val >> (8 * b)) & 0xff);
+    }
+  }
+}
+
+void JrkEmulator::Run() {
+  struct pollfd pfds[] = {
+    { .fd = masterfd, .events = POLLIN, .revents = 0, },
+    { .fd = cancelfd, .events = POLLIN, .revents = 0, },
+  };
+  unsigned char buf[256];
+  while(true){
+    if(poll(pfds, 2, -1) < 0){
+      continue;
+    }
+    if(pfds[1].revents){
+      break;
+    }
+    if(!pfds[0].revents){
+      continue;
+    }
+    auto r = read(masterfd, buf, sizeof(buf));
+    if(r <= 0){
+      continue;
+    }
+    rxbytes += r;
+    const auto service = std::chrono::microseconds(servicetime.load());
+    if(service.count()){
+      for(ssize_t i = 0 ; i < r ; ++i){
+        std::this_thread::sleep_for(service);
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          Advance(std::chrono::steady_clock::now());
+          Handle(buf[i]);
+        }
+        Flush();
+      }
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      Advance(std::chrono::steady_clock::now());
+      for(ssize_t i = 0 ; i < r ; ++i){
+        Handle(buf[i]);
+      }
+    }
+    Flush();
+  }
+}
+
+// Writes out accumulated replies. Only called from the emulator's thread.
+void JrkEmulator::Flush() {
+  size_t sent = 0;
+  while(sent < outbuf.size()){
+    auto w = ::write(masterfd, outbuf.data() + sent, outbuf.size() - sent);
+    if(w < 0){
+      if(errno == EAGAIN || errno == EINTR){
+        continue;
+      }
+      std::cerr << "emulator write error: " << strerror(errno) << std::endl;
+      break;
+    }
+    sent += w;
+  }
+  outbuf.clear();
+}
+
+}
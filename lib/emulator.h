@@ -0,0 +1,99 @@
+#ifndef POLOLUJRKUSB_LIB_EMULATOR
+#define POLOLUJRKUSB_LIB_EMULATOR
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protocol.h"
+
+namespace PololuJrkUSB {
+
+// An emulated jrk behind a pseudoterminal, speaking the compact serial
+// protocol. Open Path() with a Poller as you would /dev/ttyACM*. The motor
+// model is crude: feedback slews toward target at a fixed rate, with duty
+// cycle and current proportional to the remaining error.
+class JrkEmulator {
+public:
+  JrkEmulator(); // throws on failure to allocate a pty
+  virtual ~JrkEmulator();
+
+  const std::string& Path() const {
+    return path;
+  }
+
+  // Raises the given error flag bits until they're next read.
+  void InjectErrors(unsigned bits);
+
+  // While the motor is on, reports raw as its current (in calibration
+  // units) rather than the model's; a negative raw restores the model.
+  void InjectCurrent(int raw);
+
+  // Silently discards the next n reply bytes, as a flaky link might.
+  void DropReplyBytes(unsigned n);
+
+  // Time the emulated jrk spends on each command byte, as if it arrived
+  // over a slow UART; replies are written as each command completes. Zero
+  // (the default) processes commands as fast as they arrive.
+  void SetServiceTime(std::chrono::microseconds t);
+
+  // Latches TimeoutRX whenever no command byte arrives within t, as the
+  // jrk's PARAMETER_SERIAL_TIMEOUT does. Lapses are noticed as the next byte
+  // arrives. Zero (the default) disables the timeout.
+  void SetSerialTimeout(std::chrono::milliseconds t);
+  uint64_t SerialTimeouts() const { // lapses so far
+    return serialtimeouts;
+  }
+
+  // Motor off commands processed, and when the last one was.
+  uint64_t Stops() const {
+    return stops;
+  }
+  std::chrono::steady_clock::time_point LastStop() const {
+    return std::chrono::steady_clock::time_point(
+             std::chrono::steady_clock::duration(laststop.load()));
+  }
+
+  // Total command bytes received from the host.
+  uint64_t BytesReceived() const {
+    return rxbytes;
+  }
+
+private:
+  int masterfd;
+  int slavefd; // held open so the pty persists, and keeps its settings
+  int cancelfd;
+  std::string path;
+  std::thread thread;
+  std::atomic<uint64_t> rxbytes;
+  std::atomic<uint64_t> stops;
+  std::atomic<std::chrono::steady_clock::rep> laststop;
+  std::atomic<std::chrono::microseconds::rep> servicetime;
+  std::atomic<uint64_t> serialtimeouts;
+
+  std::mutex lock; // guards everything below
+  int target;
+  double feedback;
+  bool off;
+  unsigned errors;
+  int current; // injected current, or -1
+  std::chrono::steady_clock::time_point updated;
+  int pendingtarget; // first byte of a set target command, or -1
+  unsigned dropbytes; // reply bytes yet to be discarded
+  std::chrono::milliseconds serialtimeout;
+  std::chrono::steady_clock::time_point lastrx; // last command byte
+  std::vector<unsigned char> outbuf; // replies to write after this batch
+
+  void Run();
+  void Advance(std::chrono::steady_clock::time_point now);
+  int DutyCycle() const;
+  int Value(JrkVar var);
+  void Handle(unsigned char byte);
+  void Flush();
+};
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include <string>
 #include <poll.h>
+#include <cerrno>
 #include <cstring>
+#include <algorithm>
 #include <fcntl.h>
 #include <cassert>
 #include <iomanip>
@@ -8,106 +10,61 @@
 #include <iostream>
 #include <termios.h>
 #include <stdexcept>
+#include <system_error>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <sys/types.h>
 #include <sys/eventfd.h>
 #include "poller.h"
+#include "uring.h"
 
 using namespace std::literals::string_literals;
 
 namespace PololuJrkUSB {
 
-// Serial commands using the "compact protocol" (i.e. non daisy-chained)
-constexpr unsigned char JRKCMD_READ_CURRENT = 0x8f;
-constexpr unsigned char JRKCMD_READ_INPUT = 0xa1;
-constexpr unsigned char JRKCMD_READ_TARGET = 0xa3;
-constexpr unsigned char JRKCMD_READ_FEEDBACK = 0xa5;
-constexpr unsigned char JRKCMD_READ_SCALED_FEEDBACK = 0xa7;
-constexpr unsigned char JRKCMD_READ_ERRORSUM = 0xa9;
-constexpr unsigned char JRKCMD_READ_DUTY_TARGET = 0xab;
-constexpr unsigned char JRKCMD_READ_DUTY = 0xad;
-constexpr unsigned char JRKCMD_READ_PIDCOUNT = 0xb1;
-constexpr unsigned char JRKCMD_READ_ERRORS = 0xb5;
-constexpr unsigned char JRKCMD_MOTOR_OFF = 0xff;
-
-// USB control transfers
-constexpr unsigned char JRKUSB_GET_PARAMETER = 0x81;
-
-// Taken from https://github.com/pololu/pololu-usb-sdk.git/Jrk/Jrk/Jrk_protocol.cs
-enum class JrkConfigParam {
-  PARAMETER_INITIALIZED = 0, // 1 bit boolean value
-  PARAMETER_INPUT_MODE = 1, // 1 byte unsigned value.  Valid values are INPUT_MODE_*.  Init parameter.
-  PARAMETER_INPUT_MINIMUM = 2, // 2 byte unsigned value (0-4095)
-  PARAMETER_INPUT_MAXIMUM = 6, // 2 byte unsigned value (0-4095)
-  PARAMETER_OUTPUT_MINIMUM = 8, // 2 byte unsigned value (0-4095)
-  PARAMETER_OUTPUT_NEUTRAL = 10, // 2 byte unsigned value (0-4095)
-  PARAMETER_OUTPUT_MAXIMUM = 12, // 2 byte unsigned value (0-4095)
-  PARAMETER_INPUT_INVERT = 16, // 1 bit boolean value
-  PARAMETER_INPUT_SCALING_DEGREE = 17, // 1 bit boolean value
-  PARAMETER_INPUT_POWER_WITH_AUX = 18, // 1 bit boolean value
-  PARAMETER_INPUT_ANALOG_SAMPLES_EXPONENT = 20, // 1 byte unsigned value, 0-8 - averages together 4 * 2^x samples
-  PARAMETER_INPUT_DISCONNECT_MINIMUM = 22, // 2 byte unsigned value (0-4095)
-  PARAMETER_INPUT_DISCONNECT_MAXIMUM = 24, // 2 byte unsigned value (0-4095)
-  PARAMETER_INPUT_NEUTRAL_MAXIMUM = 26, // 2 byte unsigned value (0-4095)
-  PARAMETER_INPUT_NEUTRAL_MINIMUM = 28, // 2 byte unsigned value (0-4095)
-
-  PARAMETER_SERIAL_MODE = 30, // 1 byte unsigned value.  Valid values are SERIAL_MODE_*.  MUST be SERIAL_MODE_USB_DUAL_PORT if INPUT_MODE!=INPUT_MODE_SERIAL.  Init variable.
-  PARAMETER_SERIAL_FIXED_BAUD_RATE = 31, // 2-byte unsigned value; 0 means autodetect.  Init parameter.
-  PARAMETER_SERIAL_TIMEOUT = 34, // 2-byte unsigned value
-  PARAMETER_SERIAL_ENABLE_CRC = 36, // 1 bit boolean value
-  PARAMETER_SERIAL_NEVER_SUSPEND = 37, // 1 bit boolean value
-  PARAMETER_SERIAL_DEVICE_NUMBER = 38, // 1 byte unsigned value, 0-127
-
-  PARAMETER_FEEDBACK_MODE = 50, // 1 byte unsigned value.  Valid values are FEEDBACK_MODE_*.  Init parameter.
-  PARAMETER_FEEDBACK_MINIMUM = 51, // 2 byte unsigned value
-  PARAMETER_FEEDBACK_MAXIMUM = 53, // 2 byte unsigned value
-  PARAMETER_FEEDBACK_INVERT = 55, // 1 bit boolean value
-  PARAMETER_FEEDBACK_POWER_WITH_AUX = 57, // 1 bit boolean value
-  PARAMETER_FEEDBACK_DEAD_ZONE = 58, // 1 byte unsigned value
-  PARAMETER_FEEDBACK_ANALOG_SAMPLES_EXPONENT = 59, // 1 byte unsigned value, 0-8 - averages together 4 * 2^x samples
-  PARAMETER_FEEDBACK_DISCONNECT_MINIMUM = 61, // 2 byte unsigned value (0-4095)
-  PARAMETER_FEEDBACK_DISCONNECT_MAXIMUM = 63, // 2 byte unsigned value (0-4095)
-
-  PARAMETER_PROPORTIONAL_MULTIPLIER = 70, // 2 byte unsigned value (0-1023)
-  PARAMETER_PROPORTIONAL_EXPONENT = 72, // 1 byte unsigned value (0-15)
-  PARAMETER_INTEGRAL_MULTIPLIER = 73, // 2 byte unsigned value (0-1023)
-  PARAMETER_INTEGRAL_EXPONENT = 75, // 1 byte unsigned value (0-15)
-  PARAMETER_DERIVATIVE_MULTIPLIER = 76, // 2 byte unsigned value (0-1023)
-  PARAMETER_DERIVATIVE_EXPONENT = 78, // 1 byte unsigned value (0-15)
-  PARAMETER_PID_PERIOD = 79, // 2 byte unsigned value
-  PARAMETER_PID_INTEGRAL_LIMIT = 81, // 2 byte unsigned value
-  PARAMETER_PID_RESET_INTEGRAL = 84, // 1 bit boolean value
-
-  PARAMETER_MOTOR_PWM_FREQUENCY = 100, // 1 byte unsigned value.  Valid values are MOTOR_PWM_FREQUENCY.  Init parameter.
-  PARAMETER_MOTOR_INVERT = 101, // 1 bit boolean value
-
-  // WARNING: The EEPROM initialization assumes the 5 parameters below are consecutive!
-  PARAMETER_MOTOR_MAX_DUTY_CYCLE_WHILE_FEEDBACK_OUT_OF_RANGE = 102, // 2 byte unsigned value (0-600)
-  PARAMETER_MOTOR_MAX_ACCELERATION_FORWARD = 104, // 2 byte unsigned value (1-600)
-  PARAMETER_MOTOR_MAX_ACCELERATION_REVERSE = 106, // 2 byte unsigned value (1-600)
-  PARAMETER_MOTOR_MAX_DUTY_CYCLE_FORWARD = 108, // 2 byte unsigned value (0-600)
-  PARAMETER_MOTOR_MAX_DUTY_CYCLE_REVERSE = 110, // 2 byte unsigned value (0-600)
-  // WARNING: The EEPROM initialization assumes the 5 parameters above are consecutive!
-
-  // WARNING: The EEPROM initialization assumes the 2 parameters below are consecutive!
-  PARAMETER_MOTOR_MAX_CURRENT_FORWARD = 112, // 1 byte unsigned value (units of current_calibration_forward)
-  PARAMETER_MOTOR_MAX_CURRENT_REVERSE = 113, // 1 byte unsigned value (units of current_calibration_reverse)
-  // WARNING: The EEPROM initialization assumes the 2 parameters above are consecutive!
-
-  // WARNING: The EEPROM initialization assumes the 2 parameters below are consecutive!
-  PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD = 114, // 1 byte unsigned value (units of mA)
-  PARAMETER_MOTOR_CURRENT_CALIBRATION_REVERSE = 115, // 1 byte unsigned value (units of mA)
-  // WARNING: The EEPROM initialization assumes the 2 parameters above are consecutive!
-
-  PARAMETER_MOTOR_BRAKE_DURATION_FORWARD = 116, // 1 byte unsigned value (units of 5 ms)
-  PARAMETER_MOTOR_BRAKE_DURATION_REVERSE = 117, // 1 byte unsigned value (units of 5 ms)
-  PARAMETER_MOTOR_COAST_WHEN_OFF = 118, // 1 bit boolean value (coast=1, brake=0)
-
-  PARAMETER_ERROR_ENABLE = 130, // 2 byte unsigned value.  See below for the meanings of the bits.
-  PARAMETER_ERROR_LATCH = 132, // 2 byte unsigned value.  See below for the meanings of the bits.
+constexpr auto DefaultReplyTimeout = std::chrono::milliseconds(250);
+// Enough to keep the jrk busy between our wakeups, without putting an
+// urgent command far behind a pipelined burst of reads.
+constexpr size_t DefaultReadWindow = 16;
+// Reads for which room is preallocated (see ReserveReads())
+constexpr size_t DefaultReadCapacity = 64;
+// After this many consecutive unanswered probes, reads held for reissue are
+// failed rather than left waiting on a device which may be gone.
+constexpr unsigned MaxResyncAttempts = 3;
+// Probe with a read that has no side effects (reading the error flags would
+// clear latched errors).
+constexpr JrkVar ProbeVar = JrkVar::Target;
+// Once the stream is flushed, the probe waits until nothing has arrived for
+// this long: comfortably more than a reply takes over USB, so that replies
+// to reads written before the flush aren't taken for the probe's.
+constexpr auto ResyncQuiet = std::chrono::milliseconds(10);
+// The cheapest command which counts as serial activity: a one-byte read
+// with a one-byte reply, and no side effects.
+constexpr JrkVar KeepaliveVar = JrkVar::Current;
+
+// Replies are at most two bytes, but the jrk answers a pipelined burst of
+// reads back to back; drain up to this much per read() when tuned for it.
+constexpr size_t BurstReadSize = 64;
+
+// IoUring backend: provided read buffers, each BurstReadSize bytes
+constexpr unsigned RxBufCount = 16;
+constexpr unsigned RxBufGroup = 0;
+constexpr unsigned RingEntries = 64;
+// Command bytes for which room is preallocated in each of txbuf and txinflight
+constexpr size_t TxReserve = 256;
+
+// user_data of our io_uring SQEs/CQEs
+enum : uint64_t {
+  TagRead = 1,
+  TagWrite,
+  TagProvide,
+  TagDoorbell, // posted via MSG_RING when commands await submission
+  TagCancel,   // posted via MSG_RING by StopPolling()
+  TagAsyncCancel,
 };
 
-int Poller::OpenDev(const char* dev) {
+int Poller::OpenDev(const char* dev, PollerTransport transport) {
   auto fd = open(dev, O_RDWR | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
   if(fd < 0){
     throw std::runtime_error("couldn't open "s + dev + ": " + strerror(errno));
@@ -117,27 +74,78 @@ int Poller::OpenDev(const char* dev) {
     close(fd);
     throw std::runtime_error("couldn't get serial settings");
   }
-  term.c_iflag &= ~(ICRNL | IXON);
-  term.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-  term.c_oflag &= ~OPOST;
+  if(transport == PollerTransport::LowLatency){
+    // No input or output processing at all, and no inter-byte timer: a
+    // (nonblocking) read returns whatever is available immediately. VMIN
+    // stays 1, since with VMIN=0 an empty read returns 0 rather than EAGAIN.
+    cfmakeraw(&term);
+    term.c_cflag |= CLOCAL | CREAD;
+    term.c_cc[VMIN] = 1;
+    term.c_cc[VTIME] = 0;
+  }else{
+    term.c_iflag &= ~(ICRNL | IXON);
+    term.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+    term.c_oflag &= ~OPOST;
+  }
   if(tcsetattr(fd, TCSANOW, &term)){
     close(fd);
     throw std::runtime_error("couldn't set serial raw");
   }
+  if(transport == PollerTransport::LowLatency){
+    // Ask the driver to push received data to the tty layer immediately,
+    // rather than batching it. Not all drivers support this (ptys don't).
+    struct serial_struct ser;
+    if(ioctl(fd, TIOCGSERIAL, &ser) == 0){
+      ser.flags |= ASYNC_LOW_LATENCY;
+      driverlowlatency = ioctl(fd, TIOCSSERIAL, &ser) == 0;
+    }
+  }
   return fd;
 }
 
-Poller::Poller(const char* dev, PollerIOCallback outcb) :
+Poller::Poller(const char* dev, PollerIOCallback outcb, PollerTransport transport,
+               PollerBackend backend) :
 devfd(-1),
 cancelfd(-1),
-iocallback(outcb) {
-  devfd = OpenDev(dev);
+readsize(transport == PollerTransport::LowLatency ? BurstReadSize : 2),
+driverlowlatency(false),
+iocallback(outcb),
+stats(),
+answered(0),
+readwindow(DefaultReadWindow),
+replytimeout(DefaultReplyTimeout),
+resyncing(false),
+probing(false),
+resyncattempts(0),
+lastmotorlen(0),
+heartbeat(0),
+keepalive(false),
+silent(false),
+sampleperiod(0),
+sampling(false),
+sampleduty(0),
+sampledutyvalid(false),
+txoff(0),
+doorbell(false),
+multishot(true),
+readdeferred(false),
+writedeferred(false),
+canceldeferred(false) {
+  ReserveReads(DefaultReadCapacity);
+  if(backend == PollerBackend::IoUring){
+    ring = std::make_unique<IoUring>(RingEntries);
+    bellring = std::make_unique<IoUring>(8);
+    rxbufs.resize(RxBufCount * BurstReadSize);
+    unprovided.reserve(RxBufCount);
+    txbuf.reserve(TxReserve);
+    txinflight.reserve(TxReserve);
+  }
+  devfd = OpenDev(dev, transport);
   cancelfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
   if(cancelfd == -1){
     close(devfd);
     throw std::runtime_error("couldn't open eventfd: "s + strerror(errno));
   }
-  std::cout << "Opened Pololu jrk " << dev << " at fd " << devfd << std::endl;
 }
 
 Poller::~Poller() {
@@ -155,6 +163,12 @@ Poller::~Poller() {
 
 void Poller::StopPolling() {
   std::lock_guard<std::mutex> guard(lock);
+  if(ring){
+    if(int err = RingDoorbell(TagCancel)){
+      throw std::runtime_error("couldn't ring poller: "s + strerror(err));
+    }
+    return;
+  }
   uint64_t events = 1;
   auto ret = ::write(cancelfd, &events, sizeof(events));
   if(ret < 0){
@@ -162,87 +176,262 @@ void Poller::StopPolling() {
   }
 }
 
-void Poller::WriteJRKCommand(int cmd, int fd) {
+// Called with lock held. With the IoUring backend, commands are appended
+// to txbuf, and the Poll() thread is rung (if it isn't the caller, and
+// hasn't been rung already) to submit them in one write. Urgent commands
+// are placed ahead of those not yet submitted.
+int Poller::Transmit(const unsigned char* buf, size_t len, bool urgent) {
+  if(buf[0] == JRKCMD_MOTOR_OFF || (buf[0] & 0xe0) == JRKCMD_SET_TARGET){
+    lastmotorlen = std::min(len, lastmotor.size());
+    std::copy(buf, buf + lastmotorlen, lastmotor.begin());
+  }
+  if(ring){
+    // txbuf only ever holds whole commands, and the decoder only tracks
+    // reads, so urgent (replyless) commands can safely jump the line
+    txbuf.insert(urgent ? txbuf.begin() : txbuf.end(), buf, buf + len);
+    if(!doorbell && txinflight.empty() && std::this_thread::get_id() != pollthread){
+      if(int err = RingDoorbell(TagDoorbell)){
+        return err;
+      }
+      doorbell = true;
+    }
+    return 0;
+  }
+  auto ss = ::write(devfd, buf, len);
+  ++stats.syscalls;
+  if(ss < 0 || (size_t)ss < len){
+    return ss < 0 ? errno : EIO;
+  }
+  stats.bytes_out += ss;
+  if(capture){
+    CaptureIO(CaptureKind::Write, buf, ss);
+  }
+  Wrote(clock::now());
+  return 0;
+}
+
+int Poller::WriteJRKCommand(int cmd) {
   assert(cmd >=0);
   assert(cmd < 0x100); // commands are a single byte
   unsigned char cmdbuf[1] = { (unsigned char)(cmd % 0x100u) };
-  errno = 0;
-  auto ss = ::write(fd, cmdbuf, sizeof(cmdbuf));
-  if(ss < 0 || (size_t)ss < sizeof(cmdbuf)){
-    throw std::runtime_error("error writing command: "s + strerror(errno));
+  return Transmit(cmdbuf, sizeof(cmdbuf));
+}
+
+// Called with lock held. Writes the read, unless we're waiting on a probe,
+// in which case it's held until the stream is resynchronized. Reads join the
+// batch in flight only until its first reply arrives; later ones are queued
+// until the batch is confirmed (see FeedBytes()).
+int Poller::IssueRead(PendingRead&& pr, clock::time_point now) {
+  if(resyncing){
+    held.PushBack(std::move(pr));
+    return 0;
+  }
+  if(answered || !queued.Empty() || (readwindow && pending.Size() >= readwindow)){
+    queued.PushBack(std::move(pr));
+    return 0;
+  }
+  return WriteRead(std::move(pr), now);
+}
+
+// Called with lock held. Writes the read straight away, whatever the read
+// window, queue or resync state; it joins the batch in flight, and extends
+// it if that's partly answered. For the Poller's own reads which can't wait.
+int Poller::WriteRead(PendingRead&& pr, clock::time_point now) {
+  pr.deadline = now + replytimeout;
+  if(int err = WriteJRKCommand(JrkDescribe(pr.var).opcode)){
+    return err;
+  }
+  decoder.Sent(pr.var);
+  pending.PushBack(std::move(pr));
+  return 0;
+}
+
+// Called with lock held. Writes queued reads while the window has room.
+void Poller::IssueQueued(clock::time_point now) {
+  while(!queued.Empty() && !resyncing && !answered &&
+        (!readwindow || pending.Size() < readwindow)){
+    auto& pr = queued.Front();
+    pr.deadline = now + replytimeout;
+    if(WriteJRKCommand(JrkDescribe(pr.var).opcode)){
+      Complete(pr, 0, EIO);
+    }else{
+      decoder.Sent(pr.var);
+      pending.PushBack(std::move(pr));
+    }
+    queued.PopFront();
   }
 }
 
-void Poller::SendJRKReadCommand(int cmd) {
+void Poller::SendJRKReadCommand(JrkVar var, PollerCompletion done) {
   std::lock_guard<std::mutex> guard(lock);
-  WriteJRKCommand(cmd, devfd);
-  sent_cmds.push(cmd);
+  if(int err = IssueRead(PendingRead{ var, clock::time_point(), std::move(done), false, }, clock::now())){
+    throw std::system_error(err, std::generic_category(), "error writing command");
+  }
+}
+
+void Poller::ReadJrk(JrkVar var) {
+  SendJRKReadCommand(var, nullptr);
+}
+
+void Poller::ReadJrk(JrkVar var, PollerCompletion done) {
+  SendJRKReadCommand(var, std::move(done));
 }
 
 void Poller::ReadJrkInput() {
-  constexpr unsigned char cmd = JRKCMD_READ_INPUT;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::Input, nullptr);
 }
 
 void Poller::ReadJrkFeedback() {
-  constexpr auto cmd = JRKCMD_READ_FEEDBACK;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::Feedback, nullptr);
 }
 
 void Poller::ReadJrkScaledFeedback() {
-  constexpr auto cmd = JRKCMD_READ_SCALED_FEEDBACK;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::ScaledFeedback, nullptr);
 }
 
 void Poller::ReadJrkTarget() {
-  constexpr auto cmd = JRKCMD_READ_TARGET;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::Target, nullptr);
 }
 
 void Poller::ReadJrkErrorSum() {
-  constexpr auto cmd = JRKCMD_READ_ERRORSUM;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::ErrorSum, nullptr);
 }
 
 void Poller::ReadJrkDutyCycleTarget() {
-  constexpr auto cmd = JRKCMD_READ_DUTY_TARGET;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::DutyCycleTarget, nullptr);
 }
 
 void Poller::ReadJrkDutyCycle() {
-  constexpr auto cmd = JRKCMD_READ_DUTY;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::DutyCycle, nullptr);
 }
 
 void Poller::ReadJrkCurrent() {
-  constexpr auto cmd = JRKCMD_READ_CURRENT;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::Current, nullptr);
+}
+
+void Poller::ReadJrkPIDCount() {
+  SendJRKReadCommand(JrkVar::PIDCount, nullptr);
 }
 
 void Poller::ReadJrkErrors() {
-  constexpr auto cmd = JRKCMD_READ_ERRORS;
-  SendJRKReadCommand(cmd);
+  SendJRKReadCommand(JrkVar::Errors, nullptr);
 }
 
-void Poller::SetJrkTarget(int target) {
+void Poller::SetJrkTarget(int target, bool urgent) {
   std::lock_guard<std::mutex> guard(lock);
-  if(target < 0 || target > 4095){
+  if(target < 0 || target > JrkTargetMax){
     throw std::invalid_argument("invalid target "s + std::to_string(target));
   }
-  unsigned char cmdbuf[] = {
-    (unsigned char)(0xC0 + (target & 0x1F)),
-    (unsigned char)((target >> 5) & 0x7F),
-  };
-  auto ss = ::write(devfd, cmdbuf, sizeof(cmdbuf));
-  if(ss < 0 || (size_t)ss < sizeof(cmdbuf)){
-    throw std::runtime_error("error writing to fd "s + strerror(errno));
+  const auto cmdbuf = JrkEncodeSetTarget(target);
+  if(int err = Transmit(cmdbuf.data(), cmdbuf.size(), urgent)){
+    throw std::system_error(err, std::generic_category(), "error writing command");
   }
 }
 
 void Poller::SetJrkOff() {
   std::lock_guard<std::mutex> guard(lock);
-  constexpr auto cmd = JRKCMD_MOTOR_OFF;
-  WriteJRKCommand(cmd, devfd); // no reply, so don't use SendJRKReadCommand
+  const unsigned char cmd = JRKCMD_MOTOR_OFF;
+  // no reply, so don't use SendJRKReadCommand
+  if(int err = Transmit(&cmd, 1, true)){
+    throw std::system_error(err, std::generic_category(), "error writing command");
+  }
+}
+
+void Poller::SetReadWindow(size_t reads) {
+  std::lock_guard<std::mutex> guard(lock);
+  readwindow = reads;
+  IssueQueued(clock::now());
+}
+
+void Poller::ReserveReads(size_t reads) {
+  std::lock_guard<std::mutex> guard(lock);
+  pending.Reserve(reads + 3); // room for a probe and a current sample
+  held.Reserve(reads);
+  queued.Reserve(reads);
+  decoder.Reserve(reads + 3);
+}
+
+void Poller::SetReplyCallback(PollerReplyCallback cb) {
+  std::lock_guard<std::mutex> guard(lock);
+  replycallback = std::move(cb);
+}
+
+void Poller::SetReplyTimeout(std::chrono::milliseconds timeout) {
+  std::lock_guard<std::mutex> guard(lock);
+  replytimeout = timeout;
+}
+
+void Poller::SetHeartbeat(std::chrono::milliseconds timeout,
+                          PollerHeartbeatCallback missed) {
+  std::lock_guard<std::mutex> guard(lock);
+  heartbeat = timeout;
+  heartbeatmissed = std::move(missed);
+  lastwrite = clock::now();
+  silent = false;
+}
+
+void Poller::SetCurrentMonitor(const JrkCurrentCalibration& cal,
+                               const CurrentMonitorConfig& cfg,
+                               std::chrono::microseconds period,
+                               PollerCurrentTripCallback tripped) {
+  std::unique_ptr<CurrentMonitor> m;
+  if(period.count()){
+    m = std::make_unique<CurrentMonitor>(cal, cfg, period);
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  currentmonitor.swap(m);
+  currenttripped = std::move(tripped);
+  sampleperiod = period;
+  nextsample = clock::now();
+}
+
+void Poller::ResetCurrentMonitor() {
+  std::lock_guard<std::mutex> guard(lock);
+  if(currentmonitor){
+    currentmonitor->Reset();
+  }
+}
+
+PollerCurrentStatus Poller::CurrentStatus() {
+  std::lock_guard<std::mutex> guard(lock);
+  if(!currentmonitor){
+    return PollerCurrentStatus{ 0, 0, CurrentTrip::None, };
+  }
+  return PollerCurrentStatus{ currentmonitor->LastMilliamps(), currentmonitor->RmsMilliamps(),
+                              currentmonitor->Tripped(), };
+}
+
+void Poller::StartCapture(const std::string& path) {
+  auto c = std::make_unique<CaptureWriter>(path);
+  std::lock_guard<std::mutex> guard(lock);
+  capture.swap(c); // any previous capture is closed once we've unlocked
+}
+
+void Poller::StopCapture() {
+  std::unique_ptr<CaptureWriter> c;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    c.swap(capture);
+  }
+  if(c){
+    c->Close();
+  }
+}
+
+// Called with lock held. A capture which can't be written is abandoned,
+// rather than failing the I/O it records.
+void Poller::CaptureIO(CaptureKind kind, const unsigned char* data, size_t len) {
+  try{
+    capture->Record(kind, data, len);
+  }catch(std::runtime_error& e){
+    std::cerr << e.what() << "; capture stopped" << std::endl;
+    capture.reset();
+  }
+}
+
+PollerStats Poller::Stats() {
+  std::lock_guard<std::mutex> guard(lock);
+  return stats;
 }
 
 std::ostream& Poller::HexOutput(std::ostream& s, const void* data, size_t len) {
@@ -257,56 +446,105 @@ std::ostream& Poller::HexOutput(std::ostream& s, const void* data, size_t len) {
   return s;
 }
 
-int Poller::USBToSigned16(uint16_t unsig) {
-  int16_t sig;
-  static_assert(sizeof(unsig) == sizeof(sig));
-  memcpy(&sig, &unsig, sizeof(sig));
-  return sig;
+// Called with lock held
+void Poller::Complete(PendingRead& pr, int value, int err) {
+  const auto& var = JrkDescribe(pr.var);
+  if(err){
+    ++stats.failed;
+  }else{
+    ++stats.replies;
+    if(replycallback && !pr.quiet){
+      replycallback(var, value);
+    }else if(!pr.done){
+      JrkFormatValue(std::cout, var, value) << std::endl;
+    }
+  }
+  if(pr.done){
+    pr.done(var, value, err);
+  }
+}
+
+// Called with lock held. A lost reply byte shifts every later reply onto
+// the wrong read, and is only noticed once the last read's deadline passes.
+// Decoded replies are therefore held in pending until every read written
+// with them has been answered, and only then delivered, in order; if a
+// deadline passes first, Resync() discards them.
+void Poller::FeedBytes(const unsigned char* buf, size_t len) {
+  /* std::cout << "received bytes: 0x";
+  HexOutput(std::cout, buf, len) << std::endl; */
+  stats.bytes_in += len;
+  ++stats.reads;
+  auto now = clock::now();
+  if(resyncing && !probing){
+    // Replies to reads written before the flush; the probe must wait
+    // until they've stopped arriving.
+    stats.dropped += len;
+    probedue = now + ResyncQuiet;
+    if(capture){
+      CaptureIO(CaptureKind::Resync, buf, len);
+    }
+    return;
+  }
+  if(capture){
+    CaptureIO(CaptureKind::Read, buf, len);
+  }
+  auto unclaimed = decoder.Feed(buf, len,
+    [this](const JrkVariable&, int val){
+      pending[answered++].value = val;
+    });
+  if(unclaimed){
+    std::cerr << "warning: no outstanding command for recv" << std::endl;
+  }
+  if(answered == pending.Size()){
+    Confirm(now);
+  }
+  IssueQueued(now);
+}
+
+// Called with lock held, once every pending read has been answered
+void Poller::Confirm(clock::time_point now) {
+  while(answered){
+    --answered;
+    auto& pr = pending.Front();
+    if(!pr.probe){
+      Complete(pr, pr.value, 0);
+      pending.PopFront();
+      continue;
+    }
+    pending.PopFront();
+    // The probe was answered, so we're back in sync: reissue everything
+    // which was held in the meantime.
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - resyncstart);
+    stats.recovery_last = elapsed;
+    stats.recovery_max = std::max(stats.recovery_max, elapsed);
+    ++stats.recoveries;
+    resyncing = false;
+    probing = false;
+    resyncattempts = 0;
+    while(!held.Empty()){
+      auto& h = held.Front();
+      if(IssueRead(std::move(h), now)){
+        Complete(h, 0, EIO);
+      }
+      held.PopFront();
+    }
+  }
 }
 
 void Poller::HandleUSB() {
-  constexpr auto bufsize = 2;
-  unsigned char valbuf[bufsize];
+  unsigned char valbuf[BurstReadSize];
+  ssize_t r;
   errno = 0;
 
-  // FIXME only want to read one byte if command was ReadCurrent
-  while((read(devfd, valbuf, bufsize)) == bufsize){
-    unsigned uword = valbuf[1] * 256 + valbuf[0];
-    /* std::cout << "received bytes: 0x";
-    HexOutput(std::cout, valbuf, sizeof(valbuf)) << " (" << uword << ")" << std::endl; */
-    if(sent_cmds.empty()){
-      std::cerr << "warning: no outstanding command for recv" << std::endl;
-      continue;
+  while(true){
+    r = read(devfd, valbuf, readsize);
+    ++stats.syscalls;
+    if(r <= 0){
+      break;
     }
-    unsigned char expcmd = sent_cmds.front();
-    sent_cmds.pop();
-    switch(expcmd){
-      case JRKCMD_READ_INPUT: std::cout << "Input is " << uword << std::endl; break;
-      case JRKCMD_READ_TARGET: std::cout << "Target is " << uword << std::endl; break;
-      case JRKCMD_READ_FEEDBACK: std::cout << "Feedback is " << uword << std::endl; break;
-      case JRKCMD_READ_SCALED_FEEDBACK: std::cout << "Scaled feedback is " << uword << std::endl; break;
-      case JRKCMD_READ_ERRORSUM: std::cout << "Error sum (integral) is " << USBToSigned16(uword) << std::endl; break;
-      case JRKCMD_READ_DUTY_TARGET: std::cout << "Duty cycle target is " << USBToSigned16(uword) << std::endl; break;
-      case JRKCMD_READ_DUTY: std::cout << "Duty cycle is " << USBToSigned16(uword) << std::endl; break;
-      case JRKCMD_READ_ERRORS:
-        std::cout << "Error bits: " <<
-          ((uword & 0x0001) ? "AwaitingCmd " : "") <<
-          ((uword & 0x0002) ? "NoPower " : "") <<
-          ((uword & 0x0004) ? "DriveError " : "") <<
-          ((uword & 0x0008) ? "InvalidInput " : "") <<
-          ((uword & 0x0010) ? "InputDisconn " : "") <<
-          ((uword & 0x0020) ? "FdbckDisconn " : "") <<
-          ((uword & 0x0040) ? "AmpsExceeded " : "") <<
-          ((uword & 0x0080) ? "SerialSig " : "") <<
-          ((uword & 0x0100) ? "UARTOflow " : "") <<
-          ((uword & 0x0200) ? "SerialOflow " : "") <<
-          ((uword & 0x0400) ? "SerialCRC " : "") <<
-          ((uword & 0x0800) ? "SerialProto " : "") <<
-          ((uword & 0x1000) ? "TimeoutRX " : "") <<
-          ((uword == 0) ? "None" : "") << std::endl;
-        break;
-      default:
-        std::cerr << "unexpected command " << (int)expcmd << std::endl;
+    FeedBytes(valbuf, r);
+    if(static_cast<size_t>(r) < readsize){
+      return; // short read; input is drained, so skip the EAGAIN read()
     }
   }
   if(errno != EAGAIN){
@@ -315,8 +553,544 @@ void Poller::HandleUSB() {
   }
 }
 
-// FIXME generalize for multiple devices
+// Called with lock held. The oldest unanswered read has passed its
+// deadline. Replies decoded since the last confirmation may belong to other
+// reads, and every reply byte which arrives from here on is of unknown
+// provenance. So we fail the lost read, flush the device in both directions,
+// and once the line has gone quiet, send a probe. The other reads written
+// since the last confirmation are reissued once the probe is answered;
+// those the Poller issued for itself are abandoned.
+void Poller::Resync(clock::time_point now) {
+  ++stats.timeouts;
+  if(!resyncing){
+    resyncstart = now;
+  }
+  for(size_t i = 0 ; i < pending.Size() ; ++i){
+    auto& pr = pending[i];
+    if(pr.probe){
+      ++resyncattempts;
+    }else if(i == answered){
+      Complete(pr, 0, ETIMEDOUT);
+    }else if(pr.quiet){
+      Complete(pr, 0, ECANCELED);
+    }
+  }
+  // queued reads were submitted after those pending, but before any held
+  for(size_t i = queued.Size() ; i-- ; ){
+    held.PushFront(std::move(queued[i]));
+  }
+  queued.Clear();
+  for(size_t i = pending.Size() ; i-- ; ){
+    if(!pending[i].probe && !pending[i].quiet && i != answered){
+      ++stats.reissued;
+      held.PushFront(std::move(pending[i]));
+    }
+  }
+  pending.Clear();
+  answered = 0;
+  decoder.Reset();
+  // With the IoUring backend, the posted read would race any read() of ours
+  // (and a flush), so input is left to drain through the ring while we're
+  // quiet; see FeedBytes(). Reads not yet submitted are dropped from txbuf,
+  // since they're about to be reissued or abandoned.
+  if(ring){
+    UringDropReads();
+  }
+  // Whatever input is already waiting is read (and recorded) before the
+  // flush, so that a capture shows everything that was discarded.
+  unsigned char drain[64];
+  ssize_t r;
+  size_t drained = 0;
+  while(!ring && (r = read(devfd, drain, sizeof(drain))) > 0){
+    stats.dropped += r;
+    drained += r;
+    if(capture){
+      CaptureIO(CaptureKind::Resync, drain, r);
+    }
+  }
+  if(capture && !drained){
+    CaptureIO(CaptureKind::Resync, drain, 0); // mark the resync itself
+  }
+  // Flushing output discards reads not yet sent, which would otherwise be
+  // answered after the probe, but may also discard a motor command; the
+  // latest one is written again. Flushing input discards what arrived since
+  // the drain, which the quiet interval would drop anyway.
+  int unsent = 0;
+  if(ioctl(devfd, TIOCOUTQ, &unsent)){
+    unsent = 0;
+  }
+  tcflush(devfd, ring ? TCOFLUSH : TCIOFLUSH);
+  if(unsent > 0 && lastmotorlen){
+    if(int err = Transmit(lastmotor.data(), lastmotorlen, true)){
+      std::cerr << "error rewriting motor command: " << strerror(err) << std::endl;
+    }
+  }
+  if(resyncattempts >= MaxResyncAttempts){
+    CancelHeld();
+  }
+  resyncing = true;
+  probing = false;
+  probedue = now + ResyncQuiet;
+}
+
+// Called with lock held. Probes are abandoned after MaxResyncAttempts, so
+// fail everything waiting on them.
+void Poller::CancelHeld() {
+  resyncattempts = 0;
+  while(!held.Empty()){
+    Complete(held.Front(), 0, ECANCELED);
+    held.PopFront();
+  }
+}
+
+// Called with lock held, once the line has been quiet since a resync. A
+// probe which can't be written counts as a failed attempt straight away,
+// and is retried after a reply timeout.
+void Poller::SendProbe(clock::time_point now) {
+  ++stats.resyncs;
+  probing = true;
+  if(int err = WriteRead(PendingRead{ ProbeVar, clock::time_point(), nullptr, true, }, now)){
+    std::cerr << "error sending probe: " << strerror(err) << std::endl;
+    probing = false;
+    probedue = now + replytimeout;
+    if(++resyncattempts >= MaxResyncAttempts){
+      CancelHeld();
+    }
+  }
+}
+
+// Called with lock held, whenever command bytes reach the device
+void Poller::Wrote(clock::time_point now) {
+  lastwrite = now;
+  silent = false;
+}
+
+// Called with lock held. Sends a keepalive if nothing has been written for
+// half the serial timeout, and reports if a whole timeout has gone by.
+void Poller::Heartbeat(clock::time_point now) {
+  if(heartbeat == clock::duration::zero()){
+    return;
+  }
+  const auto silence = now - lastwrite;
+  if(silence > heartbeat && !silent){
+    silent = true;
+    ++stats.heartbeat_missed;
+    if(heartbeatmissed){
+      heartbeatmissed(std::chrono::duration_cast<std::chrono::nanoseconds>(silence));
+    }
+  }
+  if(silence < heartbeat / 2 || keepalive){
+    return;
+  }
+  keepalive = true;
+  ++stats.heartbeats;
+  if(int err = IssueRead(PendingRead{ KeepaliveVar, clock::time_point(),
+                                      [this](const JrkVariable&, int, int){ keepalive = false; },
+                                      false, true, }, now)){
+    keepalive = false;
+    std::cerr << "error sending keepalive: " << strerror(err) << std::endl;
+  }
+}
+
+// Called with lock held. Issues the next current sample once it's due, and
+// the last one has completed. Samples missed while one was outstanding (or
+// the Poll() thread was busy) are skipped, not made up. Sample reads are
+// written directly, like the probe, so they never wait behind other reads;
+// only the quiet interval before a probe holds them off, since any reply
+// would be dropped.
+void Poller::SampleCurrent(clock::time_point now) {
+  if(!currentmonitor || sampling || (resyncing && !probing) || now < nextsample){
+    return;
+  }
+  nextsample += sampleperiod;
+  if(nextsample <= now){
+    nextsample = now + sampleperiod;
+  }
+  sampling = true;
+  int err = WriteRead(PendingRead{ JrkVar::DutyCycle, clock::time_point(),
+                                   [this](const JrkVariable&, int value, int e){
+                                     sampleduty = value;
+                                     sampledutyvalid = !e;
+                                   },
+                                   false, true, }, now);
+  if(!err){
+    // without a direction, the sample is skipped
+    err = WriteRead(PendingRead{ JrkVar::Current, clock::time_point(),
+                                 [this](const JrkVariable&, int value, int e){
+                                   sampling = false;
+                                   if(!e && sampledutyvalid){
+                                     CurrentSampled(value);
+                                   }
+                                 },
+                                 false, true, }, now);
+  }
+  if(err){
+    sampling = false;
+    std::cerr << "error sampling current: " << strerror(err) << std::endl;
+  }
+}
+
+// Called with lock held, from the Poll() thread, as each sample completes.
+// A trip is acted on right here, rather than waiting for another wakeup.
+void Poller::CurrentSampled(int raw) {
+  ++stats.current_samples;
+  const auto trip = currentmonitor->Sample(raw, sampleduty, clock::now());
+  if(trip == CurrentTrip::None){
+    return;
+  }
+  ++stats.current_trips;
+  const unsigned char cmd = JRKCMD_MOTOR_OFF;
+  if(int err = Transmit(&cmd, 1, true)){
+    std::cerr << "error stopping motor on " << CurrentTripName(trip) << ": "
+              << strerror(err) << std::endl;
+  }
+  if(currenttripped){
+    currenttripped(trip, currentmonitor->LastMilliamps());
+  }
+}
+
+// Called with lock held
+void Poller::CheckDeadlines(clock::time_point now) {
+  while(answered < pending.Size() && pending[answered].deadline <= now){
+    Resync(now);
+  }
+  if(resyncing && !probing && probedue <= now){
+    SendProbe(now);
+  }
+  Heartbeat(now);
+  SampleCurrent(now);
+}
+
+// Called with lock held. Returns the poll() timeout in milliseconds. With
+// nothing pending, we still wake up every replytimeout, since reads written
+// from other threads don't interrupt poll(); a lost reply is thus noticed
+// within twice the reply timeout. A heartbeat wakes us when the next
+// keepalive would be due, absent other writes, and the current monitor when
+// its next sample is. While resynchronizing, we wake up for the probe.
+int Poller::PollTimeout(clock::time_point now) {
+  auto until = replytimeout;
+  if(answered < pending.Size()){
+    until = pending[answered].deadline - now;
+  }
+  if(resyncing && !probing){
+    until = std::min(until, probedue - now);
+  }
+  if(heartbeat != clock::duration::zero() && !(keepalive && silent)){
+    // with a keepalive outstanding, there's nothing to do until it's late
+    const auto due = lastwrite + (keepalive ? heartbeat : heartbeat / 2);
+    until = std::min(until, std::max<clock::duration>(due - now, clock::duration::zero()));
+  }
+  if(currentmonitor && !sampling && !(resyncing && !probing)){
+    until = std::min(until, std::max<clock::duration>(nextsample - now, clock::duration::zero()));
+  }
+  auto ms = std::chrono::ceil<std::chrono::milliseconds>(until).count();
+  return ms < 0 ? 0 : ms;
+}
+
+// Called with lock held. Posts a MSG_RING CQE with user_data tag to ring,
+// waking the Poll() thread. Returns 0, or an errno value.
+int Poller::RingDoorbell(uint64_t tag) {
+  auto sqe = bellring->GetSqe();
+  if(sqe == nullptr){
+    // the doorbell ring is full; its completions (only ever errors) may be
+    // what's holding it up
+    bellring->Reap([](const io_uring_cqe& cqe){
+      std::cerr << "error ringing poller: " << strerror(-cqe.res) << std::endl;
+    });
+    if((sqe = bellring->GetSqe()) == nullptr){
+      return EBUSY;
+    }
+  }
+  sqe->opcode = IORING_OP_MSG_RING;
+  sqe->fd = ring->Fd();
+  sqe->off = tag; // becomes user_data of the CQE posted to ring
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  auto ret = bellring->Enter(false, nullptr);
+  ++stats.syscalls;
+  bellring->Reap([](const io_uring_cqe& cqe){
+    std::cerr << "error ringing poller: " << strerror(-cqe.res) << std::endl;
+  });
+  return ret < 0 ? -ret : 0;
+}
+
+// Called with lock held, from the Poll() thread. GetSqe() fails if the
+// submission queue stays full even once submitted, e.g. while the kernel
+// holds overflowed completions; then the SQE is deferred, and retried by
+// UringLoop() once completions have been reaped. Likewise for the other
+// SQEs below.
+void Poller::UringProvide(unsigned bid) {
+  auto sqe = ring->GetSqe();
+  if(sqe == nullptr){
+    unprovided.push_back(bid);
+    return;
+  }
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = 1; // number of buffers
+  sqe->addr = reinterpret_cast<uint64_t>(rxbufs.data() + bid * BurstReadSize);
+  sqe->len = BurstReadSize;
+  sqe->off = bid;
+  sqe->buf_group = RxBufGroup;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  sqe->user_data = TagProvide;
+}
+
+// Called with lock held, from the Poll() thread. A multishot read stays
+// posted until it fails; without multishot support, we post one-shot reads
+// into the first provided buffer, and repost after each completion.
+void Poller::UringPostRead() {
+  auto sqe = ring->GetSqe();
+  if(sqe == nullptr){
+    readdeferred = true;
+    return;
+  }
+  sqe->fd = devfd;
+  sqe->off = -1; // current position; ttys are streams anyway
+  sqe->user_data = TagRead;
+  if(multishot){
+    sqe->opcode = UringOpReadMultishot;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RxBufGroup;
+  }else{
+    sqe->opcode = IORING_OP_READ;
+    sqe->addr = reinterpret_cast<uint64_t>(rxbufs.data());
+    sqe->len = readsize;
+  }
+}
+
+// Called with lock held, from the Poll() thread. Returns true if data was
+// delivered.
+bool Poller::UringReadDone(const io_uring_cqe& cqe) {
+  bool data = false;
+  if(cqe.res > 0){
+    if(cqe.flags & IORING_CQE_F_BUFFER){
+      const unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      FeedBytes(rxbufs.data() + bid * BurstReadSize, cqe.res);
+      UringProvide(bid); // hand the buffer back
+    }else{
+      FeedBytes(rxbufs.data(), cqe.res);
+    }
+    data = true;
+  }else if(cqe.res == -EINVAL && multishot){
+    multishot = false;
+    UringPostRead();
+    return false;
+  }else if(cqe.res == 0 || (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)){
+    std::cerr << "error reading serial: " << (cqe.res ? strerror(-cqe.res) : "EOF") << std::endl;
+    return false; // don't spin on a dead device
+  }
+  if(!(cqe.flags & IORING_CQE_F_MORE) && cqe.res != -ECANCELED){
+    UringPostRead();
+  }
+  return data;
+}
+
+// Called with lock held, from the Poll() thread
+void Poller::UringSubmitWrite() {
+  if(txinflight.empty()){
+    txinflight.swap(txbuf);
+    txoff = 0;
+  }
+  auto sqe = ring->GetSqe();
+  if(sqe == nullptr){
+    writedeferred = true; // txinflight waits; a stop mustn't be dropped
+    return;
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = devfd;
+  sqe->off = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(txinflight.data() + txoff);
+  sqe->len = txinflight.size() - txoff;
+  sqe->user_data = TagWrite;
+}
+
+// Called with lock held, from the Poll() thread. Removes the read opcodes
+// from txbuf, keeping set targets and motor offs. txbuf only ever holds
+// whole commands.
+void Poller::UringDropReads() {
+  size_t kept = 0;
+  for(size_t i = 0 ; i < txbuf.size() ; ++i){
+    const auto b = txbuf[i];
+    if((b & 0xe0) == JRKCMD_SET_TARGET && i + 1 < txbuf.size()){
+      txbuf[kept++] = b;
+      txbuf[kept++] = txbuf[++i];
+    }else if(b == JRKCMD_MOTOR_OFF){
+      txbuf[kept++] = b;
+    }
+  }
+  txbuf.resize(kept);
+}
+
+// Called with lock held, from the Poll() thread. Takes down the posted
+// read, so that nothing refers to our buffers.
+void Poller::UringCancelRead() {
+  auto sqe = ring->GetSqe();
+  if(sqe == nullptr){
+    canceldeferred = true;
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = TagRead;
+  sqe->user_data = TagAsyncCancel;
+}
+
+// Called with lock held, from the Poll() thread. Retries the SQEs deferred
+// for want of room, now that completions have been reaped.
+void Poller::UringRetryDeferred(bool cancelled) {
+  while(!unprovided.empty()){
+    const auto bid = unprovided.back();
+    unprovided.pop_back();
+    UringProvide(bid);
+    if(!unprovided.empty() && unprovided.back() == bid){
+      return; // still no room
+    }
+  }
+  if(canceldeferred){
+    canceldeferred = false;
+    UringCancelRead();
+  }
+  if(readdeferred && !cancelled){
+    readdeferred = false;
+    UringPostRead();
+  }
+  if(writedeferred){
+    writedeferred = false;
+    UringSubmitWrite();
+  }
+}
+
+// Called with lock held, from the Poll() thread
+void Poller::UringWriteDone(const io_uring_cqe& cqe) {
+  if(cqe.res == -EINTR || cqe.res == -EAGAIN){
+    UringSubmitWrite(); // nothing was written; a stop mustn't be dropped
+    return;
+  }
+  if(cqe.res < 0){
+    std::cerr << "error writing commands: " << strerror(-cqe.res) << std::endl;
+    txinflight.clear();
+    return;
+  }
+  stats.bytes_out += cqe.res;
+  if(capture){
+    CaptureIO(CaptureKind::Write, txinflight.data() + txoff, cqe.res);
+  }
+  txoff += cqe.res;
+  Wrote(clock::now());
+  if(txoff < txinflight.size()){
+    UringSubmitWrite(); // short write; send the remainder
+  }else{
+    txinflight.clear();
+  }
+}
+
+void Poller::UringLoop() {
+  lock.lock();
+  pollthread = std::this_thread::get_id();
+  for(unsigned bid = 0 ; bid < RxBufCount ; ++bid){
+    UringProvide(bid);
+  }
+  UringPostRead();
+  lock.unlock();
+  bool cancelled = false;
+  bool readposted = true;
+  while(readposted){
+    lock.lock();
+    UringRetryDeferred(cancelled);
+    if(cancelled && readdeferred){
+      readposted = false; // there's no read to take down
+      lock.unlock();
+      break;
+    }
+    if(!txbuf.empty() && txinflight.empty()){
+      UringSubmitWrite();
+    }
+    const bool deferred = !unprovided.empty() || readdeferred || writedeferred ||
+                          canceldeferred;
+    auto timeout = PollTimeout(clock::now());
+    if(deferred){
+      timeout = std::min(timeout, 1); // retry soon, even with nothing to reap
+    }
+    lock.unlock();
+    __kernel_timespec ts = { .tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000ll, };
+    auto ret = ring->Enter(true, cancelled && !deferred ? nullptr : &ts);
+    bool gotdata = false;
+    lock.lock();
+    ++stats.syscalls;
+    if(ret < 0 && ret != -ETIME && ret != -EINTR){
+      std::cerr << "error waiting on io_uring: " << strerror(-ret) << std::endl;
+    }
+    ring->Reap([&](const io_uring_cqe& cqe){
+      switch(cqe.user_data){
+        case TagRead:
+          gotdata |= UringReadDone(cqe);
+          if(cancelled && !(cqe.flags & IORING_CQE_F_MORE)){
+            readposted = false;
+          }
+          break;
+        case TagWrite: UringWriteDone(cqe); break;
+        case TagDoorbell: doorbell = false; break;
+        case TagCancel:
+          if(!cancelled){
+            cancelled = true;
+            UringCancelRead();
+          }
+          break;
+        case TagProvide:
+          std::cerr << "error providing buffer: " << strerror(-cqe.res) << std::endl;
+          break;
+        case TagAsyncCancel:
+          if(cqe.res < 0 && cqe.res != -EALREADY){
+            readposted = false; // nothing was posted
+          }
+          break;
+      }
+    });
+    if(gotdata){
+      ++stats.wakeups;
+    }
+    CheckDeadlines(clock::now());
+    lock.unlock();
+    if(gotdata && iocallback){
+      iocallback();
+    }
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  pollthread = std::thread::id();
+}
+
+void Poller::Service(bool readable) {
+  if(ring){
+    throw std::logic_error("Service() requires the Poll backend");
+  }
+  lock.lock();
+  if(readable){
+    ++stats.wakeups;
+    HandleUSB();
+  }
+  CheckDeadlines(clock::now());
+  lock.unlock();
+  if(readable && iocallback){
+    iocallback();
+  }
+}
+
+int Poller::ServiceTimeout() {
+  if(ring){
+    throw std::logic_error("ServiceTimeout() requires the Poll backend");
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  return PollTimeout(clock::now());
+}
+
 void Poller::Poll() {
+  if(ring){
+    UringLoop();
+  }else{
+    PollLoop();
+  }
+}
+
+// FIXME generalize for multiple devices
+void Poller::PollLoop() {
   struct pollfd pfds[] = {
     { .fd = devfd, .events = POLLIN | POLLPRI, .revents = 0, },
     { .fd = cancelfd, .events = POLLIN | POLLPRI, .revents = 0, },
@@ -324,7 +1098,10 @@ void Poller::Poll() {
   const auto nfds = sizeof(pfds) / sizeof(*pfds);
   bool cancelled = false;
   while(!cancelled){
-    auto pret = poll(pfds, nfds, -1);
+    lock.lock();
+    auto timeout = PollTimeout(clock::now());
+    lock.unlock();
+    auto pret = poll(pfds, nfds, timeout);
     if(pret < 0){
       std::cerr << "error polling " << nfds << " fds: " << strerror(errno) << std::endl;
       continue;
@@ -333,6 +1110,7 @@ void Poller::Poll() {
       if(pfds[i].revents){
         if(pfds[i].fd == devfd){
           lock.lock();
+          ++stats.wakeups;
           HandleUSB();
           lock.unlock();
           if(iocallback){
@@ -345,6 +1123,10 @@ void Poller::Poll() {
         }
       }
     }
+    lock.lock();
+    ++stats.syscalls; // the poll()
+    CheckDeadlines(clock::now());
+    lock.unlock();
   }
 }
 
@@ -1,9 +1,21 @@
 #ifndef POLOLUJRKUSB_LIB_POLLER
 #define POLOLUJRKUSB_LIB_POLLER
 
-#include <queue>
+#include <array>
 #include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
 #include <ostream>
+#include <functional>
+#include "protocol.h"
+#include "capture.h"
+#include "current.h"
+#include "ring.h"
+
+struct io_uring_cqe;
 
 namespace PololuJrkUSB {
 
@@ -13,13 +25,80 @@ constexpr unsigned Jrk12v12ProductID = 0x0085;
 
 using PollerIOCallback = void(*)();
 
+// How the serial device is configured, and how eagerly we drain it.
+enum class PollerTransport {
+  Default,    // minimal termios changes, reads sized to a single reply
+  LowLatency, // raw termios, ASYNC_LOW_LATENCY where supported, burst reads
+};
+
+// How Poll() waits for and performs I/O.
+enum class PollerBackend {
+  Poll,    // poll(2), then read(2); commands are written from the caller's thread
+  IoUring, // multishot reads kept posted on an io_uring; command writes are
+           // batched and submitted from the Poll() thread
+};
+
+class IoUring;
+
+// Invoked from the Poll() thread, with the Poller's lock held, for each
+// decoded reply. Must not call back into the Poller.
+using PollerReplyCallback = std::function<void(const JrkVariable&, int)>;
+
+// Completes a single read. err is 0 on success. Otherwise it is ETIMEDOUT if
+// this read's reply was lost, or ECANCELED if the read was abandoned while
+// resynchronizing. A reply is only delivered once every read written in the
+// same batch has been answered, so a lost byte can't shift values onto the
+// wrong reads. Invoked like a PollerReplyCallback. A completion
+// capturing more than two pointers is copied to the heap by std::function,
+// so hot paths should capture a single pointer to their state.
+using PollerCompletion = std::function<void(const JrkVariable&, int value, int err)>;
+
+// Invoked like a PollerReplyCallback when nothing was written to the device
+// for longer than its serial timeout, with the length of the silence so far.
+using PollerHeartbeatCallback = std::function<void(std::chrono::nanoseconds silence)>;
+
+// Invoked like a PollerReplyCallback when the current monitor trips, just
+// after the motor off has been written, with the offending sample.
+using PollerCurrentTripCallback = std::function<void(CurrentTrip trip, unsigned milliamps)>;
+
+struct PollerCurrentStatus {
+  unsigned milliamps; // latest sample
+  double rms_milliamps; // over the monitor's window
+  CurrentTrip trip; // latched until ResetCurrentMonitor()
+};
+
+struct PollerStats {
+  uint64_t bytes_out; // command bytes written to the device
+  uint64_t bytes_in;  // reply bytes read from the device
+  uint64_t replies;   // decoded replies
+  uint64_t wakeups;   // returns from poll() with the device ready
+  uint64_t reads;     // read() calls (or ring read completions) returning data
+  uint64_t syscalls;  // poll(), read(), write() and io_uring_enter() calls
+  uint64_t timeouts;  // replies which didn't arrive by their deadline
+  uint64_t failed;    // reads completed with an error
+  uint64_t reissued;  // reads rewritten following resynchronization
+  uint64_t resyncs;   // probes sent to resynchronize the stream
+  uint64_t heartbeats; // keepalive reads sent for lack of other traffic
+  uint64_t heartbeat_missed; // gaps in writes longer than the serial timeout
+  uint64_t current_samples; // current readings fed to the monitor
+  uint64_t current_trips; // motor offs written by the monitor
+  uint64_t dropped;   // stale bytes drained while resynchronizing
+  uint64_t recoveries; // completed resynchronizations
+  std::chrono::nanoseconds recovery_last; // timeout to successful probe
+  std::chrono::nanoseconds recovery_max;
+};
+
 class Poller {
 public:
   // Takes as parameter outcb a PollerIOCallback to fire after generating
   // output to std iostreams, to e.g. clean up readline prompts.
-  Poller(const char* dev, PollerIOCallback outcb); // throws on failure to open
+  Poller(const char* dev, PollerIOCallback outcb,
+         PollerTransport transport = PollerTransport::Default,
+         PollerBackend backend = PollerBackend::Poll); // throws on failure to open
   virtual ~Poller();
   void Poll();
+  void ReadJrk(JrkVar var); // generic read of any variable in JrkVariables[]
+  void ReadJrk(JrkVar var, PollerCompletion done);
   void ReadJrkInput();
   void ReadJrkTarget();
   void ReadJrkFeedback();
@@ -28,9 +107,88 @@ public:
   void ReadJrkDutyCycleTarget();
   void ReadJrkDutyCycle();
   void ReadJrkCurrent();
+  void ReadJrkPIDCount();
   void ReadJrkErrors();
-  void SetJrkTarget(int target);
+  // Motor off, and set target when urgent, are written ahead of any reads
+  // held back by the read window (and, with the IoUring backend, ahead of
+  // any commands not yet submitted).
+  void SetJrkTarget(int target, bool urgent = false);
   void SetJrkOff();
+
+  // At most this many reads are written to the device ahead of their
+  // replies; any more are queued by the Poller, and written as replies
+  // arrive. This bounds how long an urgent command waits behind reads
+  // already buffered by the kernel and the device. 0 means no limit.
+  void SetReadWindow(size_t reads);
+
+  // Preallocates room for this many reads outstanding (written or queued),
+  // so that the Poller needn't allocate while polling. Reads beyond this
+  // are still accepted, growing the Poller's queues.
+  void ReserveReads(size_t reads);
+
+  // Replies are printed to std::cout unless a reply callback is set.
+  void SetReplyCallback(PollerReplyCallback cb);
+  PollerStats Stats();
+
+  // A read whose reply hasn't arrived within this time is considered lost.
+  // The device is then flushed, and once the line is quiet, resynchronized
+  // with a probe read; the other reads in the lost one's batch, whose
+  // replies were held back, are reissued once the probe is answered.
+  void SetReplyTimeout(std::chrono::milliseconds timeout);
+
+  // Keeps the jrk's serial timeout (PARAMETER_SERIAL_TIMEOUT, see
+  // JrkGetSerialTimeout()) from expiring: once nothing has been written for
+  // half of timeout, a read of Current is sent (its reply isn't reported).
+  // While other commands flow, nothing extra is sent.
+  // missed is called whenever a full timeout passes with nothing written
+  // (e.g. if the Poll() thread was stalled). A timeout of 0 disables this.
+  // Set this before calling Poll(); otherwise it takes effect at the next
+  // wakeup, which may be up to a reply timeout away.
+  void SetHeartbeat(std::chrono::milliseconds timeout,
+                    PollerHeartbeatCallback missed = nullptr);
+
+  // Samples motor current every period from the polling thread: a read of
+  // DutyCycle (giving direction), then of Current, neither reported. These
+  // are written as soon as they're due, bypassing the read window and any
+  // queued or held reads (save while the line is kept quiet ahead of a
+  // resynchronizing probe); a sample whose DutyCycle read fails is skipped.
+  // Each sample is converted using cal and fed to a CurrentMonitor. When it
+  // trips, a motor off is written immediately, ahead of any other unwritten
+  // commands, and tripped is called; the motor is thus stopped within a
+  // period (plus a round trip) of the current crossing a threshold. Sampling
+  // continues, but the monitor doesn't trip again until
+  // ResetCurrentMonitor(). The period is honoured to the millisecond; 0
+  // stops monitoring. Set this before calling Poll().
+  void SetCurrentMonitor(const JrkCurrentCalibration& cal, const CurrentMonitorConfig& cfg,
+                         std::chrono::microseconds period,
+                         PollerCurrentTripCallback tripped = nullptr);
+  void ResetCurrentMonitor();
+  PollerCurrentStatus CurrentStatus(); // all zeroes if not monitoring
+
+  // Records every byte written to and read from the device to path (see
+  // capture.h), replacing any capture in progress. Throws on failure.
+  void StartCapture(const std::string& path);
+  // Flushes and closes the capture, if any. Throws if it couldn't be
+  // written. Errors while polling are reported to std::cerr, and stop the
+  // capture.
+  void StopCapture();
+
+  // Whether the driver accepted ASYNC_LOW_LATENCY (LowLatency only)
+  bool DriverLowLatency() const {
+    return driverlowlatency;
+  }
+
+  // For driving the Poller from an external event loop (e.g. ShardedPoller)
+  // rather than Poll(). Only supported by the Poll backend; both throw
+  // std::logic_error otherwise. Service() reads any available replies if
+  // readable is set, then enforces reply deadlines; ServiceTimeout() is the
+  // time in milliseconds until it's next needed.
+  int DeviceFd() const {
+    return devfd;
+  }
+  void Service(bool readable);
+  int ServiceTimeout();
+
   static std::ostream& HexOutput(std::ostream& s, const void* data, size_t len);
 
   // Direct the Poller to cease operating, but don't block on its actual exit
@@ -38,16 +196,102 @@ public:
 
 private:
   int devfd;
-  int cancelfd; // eventfd used for cancellation signal
-  std::queue<unsigned char> sent_cmds;
-  std::mutex lock; // guards sent_cmds, devfd, cancelfd
+  int cancelfd; // eventfd used for cancellation signal (Poll backend)
+  size_t readsize; // bytes requested per read()
+  bool driverlowlatency;
+  std::mutex lock; // guards all below
   PollerIOCallback iocallback;
+  PollerReplyCallback replycallback;
+  PollerStats stats;
+  JrkDecoder decoder; // pairs replies with pending reads
+  std::unique_ptr<CaptureWriter> capture; // may be null
+
+  using clock = std::chrono::steady_clock;
+  struct PendingRead {
+    JrkVar var;
+    clock::time_point deadline;
+    PollerCompletion done; // may be empty
+    bool probe; // issued to resynchronize, not on behalf of a caller
+    bool quiet = false; // issued by the Poller itself; not reported
+    int value = 0; // the reply, once answered
+  };
+  // Written, in order, awaiting replies. The first answered of them have
+  // replies, which are delivered once all of them do.
+  Ring<PendingRead> pending;
+  size_t answered;
+  Ring<PendingRead> held; // to be written once resynchronized
+  Ring<PendingRead> queued; // awaiting room in the read window
+  size_t readwindow;
+  clock::duration replytimeout;
+  bool resyncing;
+  bool probing; // the probe has been written
+  clock::time_point probedue; // when the line will have been quiet long enough
+  unsigned resyncattempts; // consecutive failed probes
+  clock::time_point resyncstart;
+  std::array<unsigned char, 2> lastmotor; // latest set target or motor off
+  size_t lastmotorlen;
+  clock::duration heartbeat; // serial timeout, or 0
+  PollerHeartbeatCallback heartbeatmissed;
+  clock::time_point lastwrite; // of a command to the device
+  bool keepalive; // a keepalive read is outstanding
+  bool silent; // heartbeatmissed was called for this gap in writes
+  std::unique_ptr<CurrentMonitor> currentmonitor; // may be null
+  PollerCurrentTripCallback currenttripped;
+  clock::duration sampleperiod;
+  clock::time_point nextsample;
+  bool sampling; // a sample's reads are outstanding
+  int sampleduty; // duty cycle read for the sample in progress
+  bool sampledutyvalid; // sampleduty was read without error
+
+  // IoUring backend
+  std::unique_ptr<IoUring> ring; // only touched by the Poll() thread
+  std::unique_ptr<IoUring> bellring; // posts MSG_RING doorbells to ring
+  std::thread::id pollthread;
+  std::vector<unsigned char> txbuf; // commands awaiting submission
+  std::vector<unsigned char> txinflight; // commands being written by ring
+  size_t txoff; // bytes of txinflight already written
+  bool doorbell; // a doorbell is on its way to the Poll() thread
+  bool multishot; // false if the kernel lacks IORING_OP_READ_MULTISHOT
+  std::vector<unsigned char> rxbufs; // provided buffers for ring reads
+  // SQEs which couldn't be had, for UringRetryDeferred()
+  std::vector<unsigned> unprovided; // buffer ids
+  bool readdeferred;
+  bool writedeferred;
+  bool canceldeferred;
 
-  int OpenDev(const char* dev);
-  void SendJRKReadCommand(int cmd);
-  void WriteJRKCommand(int cmd, int fd);
-  int USBToSigned16(uint16_t unsig);
+  int OpenDev(const char* dev, PollerTransport transport);
+  void SendJRKReadCommand(JrkVar var, PollerCompletion done);
+  // These return 0, or an errno value on failure
+  int WriteJRKCommand(int cmd);
+  int Transmit(const unsigned char* buf, size_t len, bool urgent = false);
+  void FeedBytes(const unsigned char* buf, size_t len);
+  void CaptureIO(CaptureKind kind, const unsigned char* data, size_t len);
+  int IssueRead(PendingRead&& pr, clock::time_point now); // pr is kept on failure
+  int WriteRead(PendingRead&& pr, clock::time_point now); // likewise
+  void IssueQueued(clock::time_point now);
+  void Complete(PendingRead& pr, int value, int err);
   void HandleUSB();
+  void CheckDeadlines(clock::time_point now);
+  void Confirm(clock::time_point now);
+  void Resync(clock::time_point now);
+  void CancelHeld();
+  void SendProbe(clock::time_point now);
+  void Wrote(clock::time_point now);
+  void Heartbeat(clock::time_point now);
+  void SampleCurrent(clock::time_point now);
+  void CurrentSampled(int raw);
+  int PollTimeout(clock::time_point now);
+  void PollLoop();
+  void UringLoop();
+  int RingDoorbell(uint64_t tag);
+  void UringPostRead();
+  void UringProvide(unsigned bid);
+  bool UringReadDone(const io_uring_cqe& cqe);
+  void UringSubmitWrite();
+  void UringDropReads();
+  void UringCancelRead();
+  void UringRetryDeferred(bool cancelled);
+  void UringWriteDone(const io_uring_cqe& cqe);
 
 };
 
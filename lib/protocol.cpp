@@ -0,0 +1,33 @@
+#include <ostream>
+#include "protocol.h"
+
+namespace PololuJrkUSB {
+
+// Bits of the "Get Error Flags Halting" reply, LSB first
+static const char* const JrkErrorBits[] = {
+  "AwaitingCmd", "NoPower", "DriveError", "InvalidInput", "InputDisconn",
+  "FdbckDisconn", "AmpsExceeded", "SerialSig", "UARTOflow", "SerialOflow",
+  "SerialCRC", "SerialProto", "TimeoutRX",
+};
+
+std::ostream& JrkFormatValue(std::ostream& s, const JrkVariable& v, int value) {
+  switch(v.format){
+    case JrkFormat::Scalar:
+      s << v.name << " is " << value;
+      break;
+    case JrkFormat::ErrorFlags:
+      s << v.name << ": ";
+      for(size_t b = 0 ; b < sizeof(JrkErrorBits) / sizeof(*JrkErrorBits) ; ++b){
+        if(value & (1u << b)){
+          s << JrkErrorBits[b] << ' ';
+        }
+      }
+      if(value == 0){
+        s << "None";
+      }
+      break;
+  }
+  return s;
+}
+
+}
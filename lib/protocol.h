@@ -0,0 +1,312 @@
+#ifndef POLOLUJRKUSB_LIB_PROTOCOL
+#define POLOLUJRKUSB_LIB_PROTOCOL
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+#include "ring.h"
+
+namespace PololuJrkUSB {
+
+// Variables readable using the "compact protocol" (i.e. non daisy-chained).
+// Order must match JrkVariables[], which is checked at compile time.
+enum class JrkVar : unsigned char {
+  Input,
+  Target,
+  Feedback,
+  ScaledFeedback,
+  ErrorSum,
+  DutyCycleTarget,
+  DutyCycle,
+  Current,
+  PIDCount,
+  Errors,
+};
+
+enum class JrkFormat : unsigned char {
+  Scalar,     // print the decoded value
+  ErrorFlags, // print the names of set bits
+};
+
+// Everything we know about a read command: how to encode it, how wide and
+// how signed its reply is, and how to present it to a human.
+struct JrkVariable {
+  JrkVar id;
+  unsigned char opcode; // single-byte read command
+  unsigned char width;  // reply bytes, little-endian (1 or 2)
+  bool issigned;        // reply is two's complement
+  JrkFormat format;
+  const char* name;     // human-readable name used when printing replies
+  const char* units;    // range/units of the decoded value
+  const char* cmd;      // CLI command
+  const char* help;     // CLI help text
+};
+
+constexpr JrkVariable JrkVariables[] = {
+  { JrkVar::Input, 0xa1, 2, false, JrkFormat::Scalar,
+    "Input", "0..4095", "input", "send a read input command", },
+  { JrkVar::Target, 0xa3, 2, false, JrkFormat::Scalar,
+    "Target", "0..4095", "target", "send a read target request", },
+  { JrkVar::Feedback, 0xa5, 2, false, JrkFormat::Scalar,
+    "Feedback", "0..4095", "feedback", "send a read feedback request", },
+  { JrkVar::ScaledFeedback, 0xa7, 2, false, JrkFormat::Scalar,
+    "Scaled feedback", "0..4095", "sfeedback", "send a read scaled feedback request", },
+  { JrkVar::ErrorSum, 0xa9, 2, true, JrkFormat::Scalar,
+    "Error sum (integral)", "-32768..32767", "errorsum", "send a read error sum request", },
+  { JrkVar::DutyCycleTarget, 0xab, 2, true, JrkFormat::Scalar,
+    "Duty cycle target", "-600..600", "cycletarg", "send a read duty cycle target command", },
+  { JrkVar::DutyCycle, 0xad, 2, true, JrkFormat::Scalar,
+    "Duty cycle", "-600..600", "cycle", "send a read duty cycle command", },
+  // Current is the only single-byte reply; units are set by the
+  // PARAMETER_MOTOR_CURRENT_CALIBRATION_* parameters.
+  { JrkVar::Current, 0x8f, 1, false, JrkFormat::Scalar,
+    "Current", "0..255 calibration units", "current", "send a read current command", },
+  { JrkVar::PIDCount, 0xb1, 2, false, JrkFormat::Scalar,
+    "PID period count", "0..65535", "pidcount", "send a read PID period count command", },
+  { JrkVar::Errors, 0xb5, 2, false, JrkFormat::ErrorFlags,
+    "Error bits", "bitmask", "eflags", "send a read error flags command", },
+};
+
+constexpr size_t JrkVariableCount = sizeof(JrkVariables) / sizeof(*JrkVariables);
+
+constexpr const JrkVariable& JrkDescribe(JrkVar v) {
+  return JrkVariables[static_cast<size_t>(v)];
+}
+
+// Maps an opcode to its index in JrkVariables[], or JrkNoVariable.
+constexpr unsigned char JrkNoVariable = 0xff;
+
+constexpr std::array<unsigned char, 0x100> JrkMakeOpcodeIndex() {
+  std::array<unsigned char, 0x100> idx{};
+  for(auto& i : idx){
+    i = JrkNoVariable;
+  }
+  for(size_t v = 0 ; v < JrkVariableCount ; ++v){
+    idx[JrkVariables[v].opcode] = v;
+  }
+  return idx;
+}
+
+constexpr auto JrkOpcodeIndex = JrkMakeOpcodeIndex();
+
+constexpr bool JrkVariablesConsistent() {
+  for(size_t v = 0 ; v < JrkVariableCount ; ++v){
+    if(static_cast<size_t>(JrkVariables[v].id) != v){
+      return false;
+    }
+    if(JrkVariables[v].width < 1 || JrkVariables[v].width > 2){
+      return false;
+    }
+    if(JrkOpcodeIndex[JrkVariables[v].opcode] != v){ // duplicate opcode
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(JrkVariablesConsistent(), "JrkVariables[] is malformed");
+
+// Write-only commands
+constexpr unsigned char JRKCMD_SET_TARGET = 0xc0; // low 5 bits of target
+constexpr unsigned char JRKCMD_MOTOR_OFF = 0xff;
+constexpr int JrkTargetMax = 4095;
+
+// Encodes a "Set Target High Resolution" command. target must be checked
+// against [0..JrkTargetMax] by the caller.
+constexpr std::array<unsigned char, 2> JrkEncodeSetTarget(int target) {
+  return {
+    static_cast<unsigned char>(JRKCMD_SET_TARGET + (target & 0x1f)),
+    static_cast<unsigned char>((target >> 5) & 0x7f),
+  };
+}
+
+// Decodes a little-endian reply of v.width bytes from buf, which must have
+// at least two readable bytes (the second is masked off for 1-byte replies).
+constexpr int JrkDecodeValue(const JrkVariable& v, const unsigned char* buf) {
+  const unsigned mask = v.width == 2 ? 0xffffu : 0xffu;
+  const unsigned raw = (buf[0] | (buf[1] << 8u)) & mask;
+  const int sign = static_cast<int>(v.issigned) << (v.width * 8 - 1);
+  return static_cast<int>(raw ^ sign) - sign;
+}
+
+std::ostream& JrkFormatValue(std::ostream& s, const JrkVariable& v, int value);
+
+// Pairs bytes read from the jrk with the read commands which elicited them.
+// The jrk answers in order, so all we need is a queue of what's been sent.
+class JrkDecoder {
+public:
+  void Sent(JrkVar v) {
+    pending.PushBack(static_cast<unsigned char>(v));
+  }
+
+  // Invokes f(const JrkVariable&, int) for each completed reply in buf.
+  // Returns the number of bytes which arrived with no command outstanding.
+  template<typename F>
+  size_t Feed(const unsigned char* buf, size_t len, F&& f) {
+    size_t unclaimed = 0;
+    while(len){
+      if(pending.Empty()){
+        unclaimed += len;
+        break;
+      }
+      const auto& v = JrkVariables[pending.Front()];
+      if(partlen == 0 && len > 1){ // whole reply present; decode in place
+        f(v, JrkDecodeValue(v, buf));
+        pending.PopFront();
+        buf += v.width;
+        len -= v.width;
+        continue;
+      }
+      partial[partlen++] = *buf++;
+      --len;
+      if(partlen == v.width){
+        f(v, JrkDecodeValue(v, partial));
+        pending.PopFront();
+        partlen = 0;
+        partial[1] = 0;
+      }
+    }
+    return unclaimed;
+  }
+
+  // Preallocates room for n commands outstanding
+  void Reserve(size_t n) {
+    pending.Reserve(n);
+  }
+
+  size_t Outstanding() const {
+    return pending.Size();
+  }
+
+  // Forgets all outstanding commands and any partial reply.
+  void Reset() {
+    pending.Clear();
+    partlen = 0;
+    partial[1] = 0;
+  }
+
+private:
+  Ring<unsigned char> pending{64}; // indices into JrkVariables[]
+  unsigned char partial[2] = {0, 0};
+  unsigned partlen = 0;
+};
+
+enum class JrkCommandKind : unsigned char {
+  Read,      // arg is the JrkVar
+  SetTarget, // arg is the target
+  MotorOff,
+  Unknown,   // arg is the unrecognized byte
+};
+
+// Splits bytes written to the jrk back into commands, e.g. when replaying a
+// capture. The inverse of JrkEncodeSetTarget() and friends.
+class JrkCommandParser {
+public:
+  // Invokes f(JrkCommandKind, int arg) for each complete command in buf. A
+  // Set Target split across calls is reassembled.
+  template<typename F>
+  void Feed(const unsigned char* buf, size_t len, F&& f) {
+    for(size_t i = 0 ; i < len ; ++i){
+      const unsigned char b = buf[i];
+      if(targetlow >= 0){
+        const int low = targetlow;
+        targetlow = -1;
+        if(b < 0x80){
+          f(JrkCommandKind::SetTarget, low | (b << 5));
+          continue;
+        }
+        f(JrkCommandKind::Unknown, JRKCMD_SET_TARGET + low);
+      }
+      if((b & 0xe0) == JRKCMD_SET_TARGET){
+        targetlow = b & 0x1f;
+      }else if(b == JRKCMD_MOTOR_OFF){
+        f(JrkCommandKind::MotorOff, 0);
+      }else if(JrkOpcodeIndex[b] != JrkNoVariable){
+        f(JrkCommandKind::Read, JrkOpcodeIndex[b]);
+      }else{
+        f(JrkCommandKind::Unknown, b);
+      }
+    }
+  }
+
+private:
+  int targetlow = -1; // low 5 bits of a Set Target awaiting its second byte
+};
+
+// Taken from https://github.com/pololu/pololu-usb-sdk.git/Jrk/Jrk/Jrk_protocol.cs
+enum class JrkConfigParam {
+  PARAMETER_INITIALIZED = 0, // 1 bit boolean value
+  PARAMETER_INPUT_MODE = 1, // 1 byte unsigned value.  Valid values are INPUT_MODE_*.  Init parameter.
+  PARAMETER_INPUT_MINIMUM = 2, // 2 byte unsigned value (0-4095)
+  PARAMETER_INPUT_MAXIMUM = 6, // 2 byte unsigned value (0-4095)
+  PARAMETER_OUTPUT_MINIMUM = 8, // 2 byte unsigned value (0-4095)
+  PARAMETER_OUTPUT_NEUTRAL = 10, // 2 byte unsigned value (0-4095)
+  PARAMETER_OUTPUT_MAXIMUM = 12, // 2 byte unsigned value (0-4095)
+  PARAMETER_INPUT_INVERT = 16, // 1 bit boolean value
+  PARAMETER_INPUT_SCALING_DEGREE = 17, // 1 bit boolean value
+  PARAMETER_INPUT_POWER_WITH_AUX = 18, // 1 bit boolean value
+  PARAMETER_INPUT_ANALOG_SAMPLES_EXPONENT = 20, // 1 byte unsigned value, 0-8 - averages together 4 * 2^x samples
+  PARAMETER_INPUT_DISCONNECT_MINIMUM = 22, // 2 byte unsigned value (0-4095)
+  PARAMETER_INPUT_DISCONNECT_MAXIMUM = 24, // 2 byte unsigned value (0-4095)
+  PARAMETER_INPUT_NEUTRAL_MAXIMUM = 26, // 2 byte unsigned value (0-4095)
+  PARAMETER_INPUT_NEUTRAL_MINIMUM = 28, // 2 byte unsigned value (0-4095)
+
+  PARAMETER_SERIAL_MODE = 30, // 1 byte unsigned value.  Valid values are SERIAL_MODE_*.  MUST be SERIAL_MODE_USB_DUAL_PORT if INPUT_MODE!=INPUT_MODE_SERIAL.  Init variable.
+  PARAMETER_SERIAL_FIXED_BAUD_RATE = 31, // 2-byte unsigned value; 0 means autodetect.  Init parameter.
+  PARAMETER_SERIAL_TIMEOUT = 34, // 2-byte unsigned value
+  PARAMETER_SERIAL_ENABLE_CRC = 36, // 1 bit boolean value
+  PARAMETER_SERIAL_NEVER_SUSPEND = 37, // 1 bit boolean value
+  PARAMETER_SERIAL_DEVICE_NUMBER = 38, // 1 byte unsigned value, 0-127
+
+  PARAMETER_FEEDBACK_MODE = 50, // 1 byte unsigned value.  Valid values are FEEDBACK_MODE_*.  Init parameter.
+  PARAMETER_FEEDBACK_MINIMUM = 51, // 2 byte unsigned value
+  PARAMETER_FEEDBACK_MAXIMUM = 53, // 2 byte unsigned value
+  PARAMETER_FEEDBACK_INVERT = 55, // 1 bit boolean value
+  PARAMETER_FEEDBACK_POWER_WITH_AUX = 57, // 1 bit boolean value
+  PARAMETER_FEEDBACK_DEAD_ZONE = 58, // 1 byte unsigned value
+  PARAMETER_FEEDBACK_ANALOG_SAMPLES_EXPONENT = 59, // 1 byte unsigned value, 0-8 - averages together 4 * 2^x samples
+  PARAMETER_FEEDBACK_DISCONNECT_MINIMUM = 61, // 2 byte unsigned value (0-4095)
+  PARAMETER_FEEDBACK_DISCONNECT_MAXIMUM = 63, // 2 byte unsigned value (0-4095)
+
+  PARAMETER_PROPORTIONAL_MULTIPLIER = 70, // 2 byte unsigned value (0-1023)
+  PARAMETER_PROPORTIONAL_EXPONENT = 72, // 1 byte unsigned value (0-15)
+  PARAMETER_INTEGRAL_MULTIPLIER = 73, // 2 byte unsigned value (0-1023)
+  PARAMETER_INTEGRAL_EXPONENT = 75, // 1 byte unsigned value (0-15)
+  PARAMETER_DERIVATIVE_MULTIPLIER = 76, // 2 byte unsigned value (0-1023)
+  PARAMETER_DERIVATIVE_EXPONENT = 78, // 1 byte unsigned value (0-15)
+  PARAMETER_PID_PERIOD = 79, // 2 byte unsigned value
+  PARAMETER_PID_INTEGRAL_LIMIT = 81, // 2 byte unsigned value
+  PARAMETER_PID_RESET_INTEGRAL = 84, // 1 bit boolean value
+
+  PARAMETER_MOTOR_PWM_FREQUENCY = 100, // 1 byte unsigned value.  Valid values are MOTOR_PWM_FREQUENCY.  Init parameter.
+  PARAMETER_MOTOR_INVERT = 101, // 1 bit boolean value
+
+  // WARNING: The EEPROM initialization assumes the 5 parameters below are consecutive!
+  PARAMETER_MOTOR_MAX_DUTY_CYCLE_WHILE_FEEDBACK_OUT_OF_RANGE = 102, // 2 byte unsigned value (0-600)
+  PARAMETER_MOTOR_MAX_ACCELERATION_FORWARD = 104, // 2 byte unsigned value (1-600)
+  PARAMETER_MOTOR_MAX_ACCELERATION_REVERSE = 106, // 2 byte unsigned value (1-600)
+  PARAMETER_MOTOR_MAX_DUTY_CYCLE_FORWARD = 108, // 2 byte unsigned value (0-600)
+  PARAMETER_MOTOR_MAX_DUTY_CYCLE_REVERSE = 110, // 2 byte unsigned value (0-600)
+  // WARNING: The EEPROM initialization assumes the 5 parameters above are consecutive!
+
+  // WARNING: The EEPROM initialization assumes the 2 parameters below are consecutive!
+  PARAMETER_MOTOR_MAX_CURRENT_FORWARD = 112, // 1 byte unsigned value (units of current_calibration_forward)
+  PARAMETER_MOTOR_MAX_CURRENT_REVERSE = 113, // 1 byte unsigned value (units of current_calibration_reverse)
+  // WARNING: The EEPROM initialization assumes the 2 parameters above are consecutive!
+
+  // WARNING: The EEPROM initialization assumes the 2 parameters below are consecutive!
+  PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD = 114, // 1 byte unsigned value (units of mA)
+  PARAMETER_MOTOR_CURRENT_CALIBRATION_REVERSE = 115, // 1 byte unsigned value (units of mA)
+  // WARNING: The EEPROM initialization assumes the 2 parameters above are consecutive!
+
+  PARAMETER_MOTOR_BRAKE_DURATION_FORWARD = 116, // 1 byte unsigned value (units of 5 ms)
+  PARAMETER_MOTOR_BRAKE_DURATION_REVERSE = 117, // 1 byte unsigned value (units of 5 ms)
+  PARAMETER_MOTOR_COAST_WHEN_OFF = 118, // 1 bit boolean value (coast=1, brake=0)
+
+  PARAMETER_ERROR_ENABLE = 130, // 2 byte unsigned value.  See below for the meanings of the bits.
+  PARAMETER_ERROR_LATCH = 132, // 2 byte unsigned value.  See below for the meanings of the bits.
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef POLOLUJRKUSB_LIB_RING
+#define POLOLUJRKUSB_LIB_RING
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+namespace PololuJrkUSB {
+
+// A double-ended queue in one preallocated block of slots, for the Poller's
+// queues of reads. Unlike std::deque, pushes and pops never touch the heap
+// unless the ring is full, in which case it doubles; its capacity is never
+// given back, so a steady state allocates nothing. Slots are reused rather
+// than destroyed, so T must be default constructible and move assignable.
+// Not thread safe.
+template<typename T>
+class Ring {
+public:
+  explicit Ring(size_t capacity = 16) :
+  head(0),
+  count(0) {
+    Reserve(capacity);
+  }
+
+  bool Empty() const {
+    return count == 0;
+  }
+  size_t Size() const {
+    return count;
+  }
+  size_t Capacity() const {
+    return slots.size();
+  }
+
+  // i counts from the front
+  T& operator[](size_t i) {
+    return slots[(head + i) & (slots.size() - 1)];
+  }
+  T& Front() {
+    return slots[head];
+  }
+  T& Back() {
+    return (*this)[count - 1];
+  }
+
+  void PushBack(T&& t) {
+    if(count == slots.size()){
+      Reserve(count * 2);
+    }
+    (*this)[count] = std::move(t);
+    ++count;
+  }
+
+  void PushFront(T&& t) {
+    if(count == slots.size()){
+      Reserve(count * 2);
+    }
+    head = (head - 1) & (slots.size() - 1);
+    slots[head] = std::move(t);
+    ++count;
+  }
+
+  // The popped slot is reset, releasing anything it held
+  void PopFront() {
+    slots[head] = T();
+    head = (head + 1) & (slots.size() - 1);
+    --count;
+  }
+
+  void Clear() {
+    while(count){
+      PopFront();
+    }
+  }
+
+  // Ensures room for n elements, rounded up to a power of two
+  void Reserve(size_t n) {
+    size_t cap = 1;
+    while(cap < n){
+      cap <<= 1;
+    }
+    if(cap <= slots.size()){
+      return;
+    }
+    std::vector<T> grown(cap);
+    for(size_t i = 0 ; i < count ; ++i){
+      grown[i] = std::move((*this)[i]);
+    }
+    slots.swap(grown);
+    head = 0;
+  }
+
+private:
+  std::vector<T> slots; // size is a power of two
+  size_t head; // index of the front element
+  size_t count;
+};
+
+}
+
+#endif
@@ -0,0 +1,408 @@
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include "shard.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+ShardInbox::ShardInbox(unsigned size) :
+mask(1),
+tail(0),
+head(0) {
+  while(mask < size){
+    mask <<= 1;
+  }
+  cells = std::make_unique<Cell[]>(mask);
+  for(size_t i = 0 ; i < mask ; ++i){
+    cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  --mask;
+}
+
+bool ShardInbox::TryPush(ShardCommand&& cmd) {
+  size_t pos = tail.load(std::memory_order_relaxed);
+  Cell* cell;
+  while(true){
+    cell = &cells[pos & mask];
+    const size_t seq = cell->seq.load(std::memory_order_acquire);
+    const auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if(dif == 0){
+      if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+        break;
+      }
+    }else if(dif < 0){
+      return false; // full
+    }else{
+      pos = tail.load(std::memory_order_relaxed);
+    }
+  }
+  cell->cmd = std::move(cmd);
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool ShardInbox::TryPop(ShardCommand& cmd) {
+  Cell& cell = cells[head & mask];
+  if(cell.seq.load(std::memory_order_acquire) != head + 1){
+    return false; // empty, or the push into this cell hasn't finished
+  }
+  cmd = std::move(cell.cmd);
+  cell.cmd.done = nullptr;
+  cell.seq.store(head + mask + 1, std::memory_order_release);
+  ++head;
+  return true;
+}
+
+bool ShardInbox::Empty() const {
+  return cells[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+}
+
+ShardedPoller::ShardedPoller(const ShardConfig& config) :
+cfg(config),
+devices(std::make_unique<DeviceSlot[]>(config.maxdevices)),
+devcount(0),
+stopping(false) {
+  const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned count = cfg.shards ? cfg.shards : cpus;
+  for(unsigned i = 0 ; i < count ; ++i){
+    auto s = std::make_unique<Shard>(cfg.inboxsize);
+    s->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(s->wakefd < 0){
+      auto err = errno;
+      for(auto& prev : shards){
+        close(prev->wakefd);
+      }
+      throw std::runtime_error("couldn't open eventfd: "s + strerror(err));
+    }
+    shards.emplace_back(std::move(s));
+  }
+  for(unsigned i = 0 ; i < count ; ++i){
+    shards[i]->thread = std::thread(&ShardedPoller::Run, this, i);
+    if(cfg.pin){
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(i % cpus, &set);
+      auto err = pthread_setaffinity_np(shards[i]->thread.native_handle(), sizeof(set), &set);
+      if(err){
+        std::cerr << "couldn't pin shard " << i << ": " << strerror(err) << std::endl;
+      }
+    }
+  }
+  if(cfg.rebalance.count()){
+    balancer = std::thread(&ShardedPoller::Balance, this);
+  }
+}
+
+void ShardedPoller::Balance() {
+  std::unique_lock<std::mutex> lk(stoplock);
+  while(!stopcv.wait_for(lk, cfg.rebalance, [this]{ return stopping.load(); })){
+    Rebalance();
+  }
+}
+
+ShardedPoller::~ShardedPoller() {
+  {
+    std::lock_guard<std::mutex> guard(stoplock);
+    stopping = true;
+  }
+  stopcv.notify_all();
+  if(balancer.joinable()){
+    balancer.join();
+  }
+  for(auto& s : shards){
+    uint64_t v = 1;
+    if(::write(s->wakefd, &v, sizeof(v)) < 0){
+      std::cerr << "error waking shard: " << strerror(errno) << std::endl;
+    }
+  }
+  for(auto& s : shards){
+    s->thread.join();
+    close(s->wakefd);
+  }
+}
+
+// Queues cmd to s, waking its thread if it's (about to be) asleep. Spins
+// while the inbox is full.
+void ShardedPoller::Post(Shard& s, ShardCommand&& cmd, bool urgent) {
+  auto& inbox = urgent ? s.urgent : s.inbox;
+  while(!inbox.TryPush(std::move(cmd))){
+    uint64_t v = 1;
+    if(::write(s.wakefd, &v, sizeof(v)) < 0){
+      throw std::runtime_error("couldn't wake shard: "s + strerror(errno));
+    }
+    std::this_thread::yield();
+  }
+  // pairs with the fence in Run(): either we see it sleeping, or it sees
+  // our command before sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(s.sleeping.load(std::memory_order_relaxed)){
+    uint64_t v = 1;
+    if(::write(s.wakefd, &v, sizeof(v)) < 0){
+      throw std::runtime_error("couldn't wake shard: "s + strerror(errno));
+    }
+  }
+}
+
+// Routes cmd to dev's owner. A migrating shard waits for inflight to drop
+// to zero after retargeting owner, so a command posted to the old owner is
+// always queued before that shard hands the device over.
+void ShardedPoller::Submit(ShardDeviceId dev, ShardCommand&& cmd, bool urgent) {
+  if(dev >= devcount.load(std::memory_order_acquire)){
+    throw std::runtime_error("no such device "s + std::to_string(dev));
+  }
+  auto& d = devices[dev];
+  cmd.dev = dev;
+  d.inflight.fetch_add(1, std::memory_order_seq_cst);
+  const auto owner = d.owner.load(std::memory_order_seq_cst);
+  try{
+    Post(*shards[owner], std::move(cmd), urgent);
+  }catch(...){
+    d.inflight.fetch_sub(1, std::memory_order_release);
+    throw;
+  }
+  d.inflight.fetch_sub(1, std::memory_order_release);
+}
+
+ShardDeviceId ShardedPoller::AddDevice(const char* dev) {
+  std::lock_guard<std::mutex> guard(addlock);
+  const auto id = devcount.load(std::memory_order_relaxed);
+  if(id >= cfg.maxdevices){
+    throw std::runtime_error("already polling "s + std::to_string(id) + " devices");
+  }
+  auto& d = devices[id];
+  d.poller = std::make_unique<Poller>(dev, nullptr, cfg.transport);
+  unsigned best = 0;
+  for(unsigned i = 1 ; i < shards.size() ; ++i){
+    if(shards[i]->devcount < shards[best]->devcount){
+      best = i;
+    }
+  }
+  d.owner = best;
+  d.inflight = 0;
+  d.load = 0;
+  d.lastload = 0;
+  ++shards[best]->devcount; // claim it now, so concurrent adds spread out
+  devcount.store(id + 1, std::memory_order_release);
+  Post(*shards[best], ShardCommand{ ShardCommand::Op::Adopt, JrkVar::Input, id, 0, false, nullptr, });
+  return id;
+}
+
+void ShardedPoller::ReadJrk(ShardDeviceId dev, JrkVar var, PollerCompletion done) {
+  Submit(dev, ShardCommand{ ShardCommand::Op::Read, var, dev, 0, false, std::move(done), });
+}
+
+void ShardedPoller::SetJrkTarget(ShardDeviceId dev, int target, bool urgent) {
+  Submit(dev, ShardCommand{ ShardCommand::Op::SetTarget, JrkVar::Input, dev, target, urgent, nullptr, },
+         urgent);
+}
+
+void ShardedPoller::SetJrkOff(ShardDeviceId dev) {
+  Submit(dev, ShardCommand{ ShardCommand::Op::Off, JrkVar::Input, dev, 0, true, nullptr, }, true);
+}
+
+Poller& ShardedPoller::Device(ShardDeviceId dev) {
+  if(dev >= devcount.load(std::memory_order_acquire)){
+    throw std::runtime_error("no such device "s + std::to_string(dev));
+  }
+  return *devices[dev].poller;
+}
+
+unsigned ShardedPoller::ShardOf(ShardDeviceId dev) const {
+  return devices[dev].owner.load(std::memory_order_relaxed);
+}
+
+std::vector<ShardStats> ShardedPoller::Stats() const {
+  std::vector<ShardStats> ret;
+  for(const auto& s : shards){
+    ret.push_back(ShardStats{ s->devcount.load(), s->commands.load(),
+                              s->wakeups.load(), s->migrations.load(), });
+  }
+  return ret;
+}
+
+// Compares the commands executed by each shard since the last call. If the
+// busiest shard did more than 1/8 more work than the least busy, moves the
+// device whose load best halves the difference between them.
+bool ShardedPoller::Rebalance() {
+  std::lock_guard<std::mutex> guard(balancelock);
+  const auto n = devcount.load(std::memory_order_acquire);
+  std::vector<uint64_t> delta(n);
+  std::vector<uint64_t> shardload(shards.size());
+  for(unsigned i = 0 ; i < n ; ++i){
+    auto& d = devices[i];
+    const auto load = d.load.load(std::memory_order_relaxed);
+    delta[i] = load - d.lastload;
+    d.lastload = load;
+    shardload[d.owner.load(std::memory_order_relaxed)] += delta[i];
+  }
+  const auto hi = std::max_element(shardload.begin(), shardload.end()) - shardload.begin();
+  const auto lo = std::min_element(shardload.begin(), shardload.end()) - shardload.begin();
+  const auto gap = shardload[hi] - shardload[lo];
+  if(gap * 8 <= shardload[hi]){
+    return false;
+  }
+  unsigned best = n;
+  for(unsigned i = 0 ; i < n ; ++i){
+    // moving more than the gap would just swap which shard is busiest
+    if(devices[i].owner.load(std::memory_order_relaxed) != hi || !delta[i] || delta[i] >= gap){
+      continue;
+    }
+    const auto miss = [gap](uint64_t l){
+      return l > gap / 2 ? l - gap / 2 : gap / 2 - l;
+    };
+    if(best == n || miss(delta[i]) < miss(delta[best])){
+      best = i;
+    }
+  }
+  if(best == n){
+    return false;
+  }
+  Submit(best, ShardCommand{ ShardCommand::Op::Migrate, JrkVar::Input, best,
+                             static_cast<int>(lo), false, nullptr, });
+  return true;
+}
+
+void ShardedPoller::Run(unsigned idx) {
+  Shard& me = *shards[idx];
+  std::vector<char> mine(cfg.maxdevices); // devices this thread polls
+  std::vector<ShardDeviceId> owned; // owned[i] is polled via pfds[i + 1]
+  std::vector<pollfd> pfds{ { .fd = me.wakefd, .events = POLLIN, .revents = 0, }, };
+  std::vector<ShardCommand> parked; // routed here, but not yet adopted
+  struct Handover {
+    ShardDeviceId dev;
+    unsigned to;
+    bool ticketed;
+    size_t ticket; // inbox position after which dev may be handed over
+    size_t urgentticket; // likewise for the urgent inbox
+  };
+  std::vector<Handover> handovers;
+
+  auto perform = [&](ShardCommand& cmd){
+    auto& d = devices[cmd.dev];
+    if(cmd.op == ShardCommand::Op::Migrate){
+      const unsigned to = cmd.arg;
+      const bool already = std::any_of(handovers.begin(), handovers.end(),
+                            [&cmd](const Handover& h){ return h.dev == cmd.dev; });
+      if(to != idx && to < shards.size() && !already){
+        d.owner.store(to, std::memory_order_seq_cst);
+        handovers.push_back(Handover{ cmd.dev, to, false, 0, 0, });
+      }
+      return;
+    }
+    try{
+      switch(cmd.op){
+        case ShardCommand::Op::Read:
+          d.poller->ReadJrk(cmd.var, std::move(cmd.done));
+          break;
+        case ShardCommand::Op::SetTarget:
+          d.poller->SetJrkTarget(cmd.arg, cmd.urgent);
+          break;
+        case ShardCommand::Op::Off:
+          d.poller->SetJrkOff();
+          break;
+        default:
+          break;
+      }
+    }catch(std::runtime_error& e){
+      if(cmd.done){
+        cmd.done(JrkDescribe(cmd.var), 0, EIO);
+      }else{
+        std::cerr << "error sending command: " << e.what() << std::endl;
+      }
+    }
+    d.load.fetch_add(1, std::memory_order_relaxed);
+    me.commands.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  while(!stopping.load(std::memory_order_relaxed)){
+    ShardCommand cmd;
+    // the urgent inbox is checked before each command from the other
+    while(me.urgent.TryPop(cmd) || me.inbox.TryPop(cmd)){
+      if(cmd.op == ShardCommand::Op::Adopt){
+        mine[cmd.dev] = true;
+        owned.push_back(cmd.dev);
+        pfds.push_back(pollfd{ .fd = devices[cmd.dev].poller->DeviceFd(),
+                               .events = POLLIN | POLLPRI, .revents = 0, });
+        for(auto it = parked.begin() ; it != parked.end() ; ){
+          if(it->dev == cmd.dev){
+            perform(*it);
+            it = parked.erase(it);
+          }else{
+            ++it;
+          }
+        }
+      }else if(!mine[cmd.dev]){
+        parked.emplace_back(std::move(cmd));
+      }else{
+        perform(cmd);
+      }
+    }
+
+    for(auto it = handovers.begin() ; it != handovers.end() ; ){
+      if(!it->ticketed && devices[it->dev].inflight.load(std::memory_order_seq_cst) == 0){
+        it->ticket = me.inbox.Tail();
+        it->urgentticket = me.urgent.Tail();
+        it->ticketed = true;
+      }
+      if(!it->ticketed || me.inbox.Head() < it->ticket ||
+         me.urgent.Head() < it->urgentticket){
+        ++it;
+        continue;
+      }
+      // everything routed to us for this device has been executed
+      auto pos = std::find(owned.begin(), owned.end(), it->dev) - owned.begin();
+      owned.erase(owned.begin() + pos);
+      pfds.erase(pfds.begin() + pos + 1);
+      mine[it->dev] = false;
+      --me.devcount;
+      ++shards[it->to]->devcount;
+      me.migrations.fetch_add(1, std::memory_order_relaxed);
+      Post(*shards[it->to], ShardCommand{ ShardCommand::Op::Adopt, JrkVar::Input, it->dev, 0, false, nullptr, });
+      it = handovers.erase(it);
+    }
+
+    int timeout = -1;
+    for(auto dev : owned){
+      const int t = devices[dev].poller->ServiceTimeout();
+      if(timeout < 0 || t < timeout){
+        timeout = t;
+      }
+    }
+    if(!handovers.empty()){
+      timeout = timeout < 0 ? 1 : std::min(timeout, 1);
+    }
+
+    me.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!me.inbox.Empty() || !me.urgent.Empty() || stopping.load(std::memory_order_relaxed)){
+      me.sleeping.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    auto pret = poll(pfds.data(), pfds.size(), timeout);
+    me.sleeping.store(false, std::memory_order_relaxed);
+    if(pret < 0){
+      std::cerr << "error polling " << pfds.size() << " fds: " << strerror(errno) << std::endl;
+      continue;
+    }
+    me.wakeups.fetch_add(1, std::memory_order_relaxed);
+    if(pfds[0].revents){
+      uint64_t v;
+      if(::read(me.wakefd, &v, sizeof(v)) < 0 && errno != EAGAIN){
+        std::cerr << "error reading eventfd: " << strerror(errno) << std::endl;
+      }
+    }
+    for(size_t i = 0 ; i < owned.size() ; ++i){
+      devices[owned[i]].poller->Service(pfds[i + 1].revents);
+    }
+  }
+}
+
+}
@@ -0,0 +1,162 @@
+#ifndef POLOLUJRKUSB_LIB_SHARD
+#define POLOLUJRKUSB_LIB_SHARD
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include "poller.h"
+
+namespace PololuJrkUSB {
+
+struct ShardConfig {
+  unsigned shards = 0;      // poll threads; 0 means one per online CPU
+  bool pin = true;          // pin shard i to CPU i (modulo the CPU count)
+  unsigned maxdevices = 1024;
+  unsigned inboxsize = 4096; // commands queued per shard (rounded up to 2^n)
+  std::chrono::milliseconds rebalance{1000}; // 0 disables rebalancing
+  PollerTransport transport = PollerTransport::LowLatency;
+};
+
+struct ShardStats {
+  unsigned devices;   // currently owned
+  uint64_t commands;  // executed on behalf of callers
+  uint64_t wakeups;   // returns from poll()
+  uint64_t migrations; // devices handed to other shards
+};
+
+using ShardDeviceId = unsigned;
+
+// Commands queued to a shard from any thread. A bounded multi-producer,
+// single-consumer ring (after Vyukov); pushes never take a lock.
+struct ShardCommand {
+  enum class Op : unsigned char {
+    Read, SetTarget, Off, // on behalf of callers
+    Adopt,   // take ownership of dev
+    Migrate, // hand dev to shard arg
+  };
+  Op op;
+  JrkVar var;
+  ShardDeviceId dev;
+  int arg;
+  bool urgent; // SetTarget only
+  PollerCompletion done; // Read only; may be empty
+};
+
+class ShardInbox {
+public:
+  explicit ShardInbox(unsigned size);
+
+  bool TryPush(ShardCommand&& cmd); // false if full
+  bool TryPop(ShardCommand& cmd);   // consumer only; false if empty
+  bool Empty() const;               // consumer only
+
+  // Every push which began before this was read lies before it in the ring.
+  size_t Tail() const {
+    return tail.load(std::memory_order_seq_cst);
+  }
+
+  // Commands popped so far (consumer only)
+  size_t Head() const {
+    return head;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    ShardCommand cmd;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) size_t head;
+};
+
+// Polls many jrks from a fixed set of threads (shards), each optionally
+// pinned to a core. Every device is owned by exactly one shard, and is only
+// touched by that shard's thread: commands from other threads are routed
+// through the owner's inbox. Completions are invoked from the owning shard's
+// thread, as described for PollerCompletion.
+//
+// Every rebalance period, load (commands executed per device) is compared
+// across shards, and a device may be migrated from the busiest shard to the
+// least busy. Commands submitted for a device are executed in the order
+// they were submitted, across migrations, except that urgent commands may
+// overtake others.
+class ShardedPoller {
+public:
+  explicit ShardedPoller(const ShardConfig& cfg = ShardConfig()); // starts shards
+  virtual ~ShardedPoller(); // stops and joins shards, closing devices
+
+  // Opens dev (see Poller), placing it on the least loaded shard. Throws on
+  // failure to open, or if maxdevices are already open.
+  ShardDeviceId AddDevice(const char* dev);
+
+  void ReadJrk(ShardDeviceId dev, JrkVar var, PollerCompletion done);
+  // Motor off and urgent targets travel through a separate per-shard lane,
+  // which is drained ahead of other commands (see also Poller::SetJrkOff()).
+  void SetJrkTarget(ShardDeviceId dev, int target, bool urgent = false);
+  void SetJrkOff(ShardDeviceId dev);
+
+  // The Poller behind dev, e.g. for Stats(). Commands must not be sent
+  // through it directly.
+  Poller& Device(ShardDeviceId dev);
+
+  unsigned Shards() const {
+    return shards.size();
+  }
+  unsigned ShardOf(ShardDeviceId dev) const;
+  std::vector<ShardStats> Stats() const;
+
+  // Performs one rebalancing step immediately. Returns true if a migration
+  // was initiated.
+  bool Rebalance();
+
+private:
+  struct DeviceSlot {
+    std::unique_ptr<Poller> poller;
+    std::atomic<unsigned> owner;    // shard to which commands are routed
+    std::atomic<unsigned> inflight; // submitters between routing and push
+    std::atomic<uint64_t> load;     // commands executed
+    uint64_t lastload;              // load at the last rebalance
+  };
+
+  static constexpr unsigned UrgentInboxSize = 256;
+
+  struct Shard {
+    explicit Shard(unsigned inboxsize) : inbox(inboxsize), urgent(UrgentInboxSize) {}
+    ShardInbox inbox;
+    ShardInbox urgent; // safety commands, drained first
+    int wakefd;
+    std::atomic<bool> sleeping{false};
+    std::atomic<unsigned> devcount{0};
+    std::atomic<uint64_t> commands{0};
+    std::atomic<uint64_t> wakeups{0};
+    std::atomic<uint64_t> migrations{0};
+    std::thread thread;
+  };
+
+  ShardConfig cfg;
+  std::unique_ptr<DeviceSlot[]> devices;
+  std::atomic<unsigned> devcount;
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::atomic<bool> stopping;
+  std::mutex addlock; // serializes AddDevice()
+  std::mutex balancelock; // serializes Rebalance()
+  std::thread balancer; // calls Rebalance() every cfg.rebalance
+  std::mutex stoplock;
+  std::condition_variable stopcv; // wakes balancer when stopping
+
+  void Submit(ShardDeviceId dev, ShardCommand&& cmd, bool urgent = false);
+  void Post(Shard& s, ShardCommand&& cmd, bool urgent = false);
+  void Run(unsigned idx);
+  void Balance();
+};
+
+}
+
+#endif
@@ -0,0 +1,262 @@
+#include <cmath>
+#include <limits>
+#include <iomanip>
+#include <algorithm>
+#include "telemetry.h"
+
+namespace PololuJrkUSB {
+
+P2Quantile::P2Quantile(double quantile) :
+p(quantile) {
+  Reset();
+}
+
+void P2Quantile::Reset() {
+  count = 0;
+  for(int i = 0 ; i < 5 ; ++i){
+    n[i] = i;
+  }
+  np[0] = 0;
+  np[1] = 2 * p;
+  np[2] = 4 * p;
+  np[3] = 2 + 2 * p;
+  np[4] = 4;
+  dn[0] = 0;
+  dn[1] = p / 2;
+  dn[2] = p;
+  dn[3] = (1 + p) / 2;
+  dn[4] = 1;
+}
+
+void P2Quantile::Add(double x) {
+  if(count < 5){
+    q[count++] = x;
+    if(count == 5){
+      std::sort(q, q + 5);
+    }
+    return;
+  }
+  ++count;
+  int k;
+  if(x < q[0]){
+    q[0] = x;
+    k = 0;
+  }else if(x >= q[4]){
+    q[4] = x;
+    k = 3;
+  }else{
+    k = 0;
+    while(x >= q[k + 1]){
+      ++k;
+    }
+  }
+  for(int i = k + 1 ; i < 5 ; ++i){
+    ++n[i];
+  }
+  for(int i = 0 ; i < 5 ; ++i){
+    np[i] += dn[i];
+  }
+  for(int i = 1 ; i < 4 ; ++i){
+    const double d = np[i] - n[i];
+    if((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)){
+      const int ds = d > 0 ? 1 : -1;
+      // piecewise-parabolic prediction, falling back to linear if it would
+      // disorder the markers
+      const double qp = q[i] + ds / (n[i + 1] - n[i - 1]) *
+        ((n[i] - n[i - 1] + ds) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+         (n[i + 1] - n[i] - ds) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+      if(q[i - 1] < qp && qp < q[i + 1]){
+        q[i] = qp;
+      }else{
+        q[i] += ds * (q[i + ds] - q[i]) / (n[i + ds] - n[i]);
+      }
+      n[i] += ds;
+    }
+  }
+}
+
+double P2Quantile::Value() const {
+  if(count == 0){
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if(count < 5){ // too few for markers; use the exact order statistic
+    double sorted[5];
+    std::copy(q, q + count, sorted);
+    std::sort(sorted, sorted + count);
+    return sorted[static_cast<unsigned>(std::lround(p * (count - 1)))];
+  }
+  return q[2];
+}
+
+TelemetryAggregator::VariableWindow::VariableWindow() :
+thresholded(false),
+threshold(0),
+above(false) {
+  for(size_t i = 0 ; i < TelemetryQuantileCount ; ++i){
+    quantiles[i] = P2Quantile(TelemetryQuantiles[i]);
+  }
+  Reset(clock::time_point());
+}
+
+void TelemetryAggregator::VariableWindow::Reset(clock::time_point wstart) {
+  start = wstart;
+  count = 0;
+  min = std::numeric_limits<int>::max();
+  max = std::numeric_limits<int>::min();
+  mean = 0;
+  m2 = 0;
+  for(auto& q : quantiles){
+    q.Reset();
+  }
+  over = clock::duration::zero();
+}
+
+TelemetryAggregator::TelemetryAggregator(TelemetrySink s, const TelemetryConfig& config) :
+sink(std::move(s)),
+cfg(config),
+epoch(clock::now()),
+raw(cfg.rawsamples),
+rawnext(0),
+samples(0),
+summaries(0) {
+  for(auto& w : windows){
+    w.Reset(epoch);
+    w.last = epoch;
+  }
+}
+
+void TelemetryAggregator::SetThreshold(JrkVar var, int threshold) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto& w = windows[static_cast<size_t>(var)];
+  w.thresholded = true;
+  w.threshold = threshold;
+}
+
+// Called with lock held
+void TelemetryAggregator::Emit(VariableWindow& w, JrkVar var, clock::time_point end) {
+  if(w.above){
+    w.over += end - std::max(w.last, w.start);
+  }
+  if(w.count == 0){
+    return;
+  }
+  WindowSummary sum;
+  sum.var = var;
+  sum.start = w.start;
+  sum.length = end - w.start;
+  sum.count = w.count;
+  sum.min = w.min;
+  sum.max = w.max;
+  sum.mean = w.mean;
+  sum.variance = w.m2 / w.count;
+  for(size_t i = 0 ; i < TelemetryQuantileCount ; ++i){
+    sum.quantiles[i] = w.quantiles[i].Value();
+  }
+  sum.thresholded = w.thresholded;
+  sum.over = w.over;
+  ++summaries;
+  if(sink){
+    sink(sum);
+  }
+}
+
+void TelemetryAggregator::Record(JrkVar var, int value, clock::time_point when) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(raw.size()){
+    raw[rawnext] = RawSample{ when, var, value, };
+    rawnext = (rawnext + 1) % raw.size();
+  }
+  ++samples;
+  auto& w = windows[static_cast<size_t>(var)];
+  // Out of order (e.g. stamped by racing threads); time mustn't run backwards
+  when = std::max(when, w.last);
+  const auto wstart = epoch + (when - epoch) / cfg.window * cfg.window;
+  if(wstart > w.start){
+    Emit(w, var, w.start + cfg.window);
+    w.last = std::max(w.last, w.start + cfg.window);
+    w.Reset(wstart);
+  }
+  if(w.above){
+    w.over += when - std::max(w.last, w.start);
+  }
+  w.last = when;
+  w.above = w.thresholded && value > w.threshold;
+  ++w.count;
+  w.min = std::min(w.min, value);
+  w.max = std::max(w.max, value);
+  const double delta = value - w.mean;
+  w.mean += delta / w.count;
+  w.m2 += delta * (value - w.mean);
+  for(auto& q : w.quantiles){
+    q.Add(value);
+  }
+}
+
+PollerReplyCallback TelemetryAggregator::Callback() {
+  return [this](const JrkVariable& var, int value){
+    Record(var.id, value);
+  };
+}
+
+void TelemetryAggregator::Flush() {
+  std::lock_guard<std::mutex> guard(lock);
+  const auto now = clock::now();
+  for(size_t v = 0 ; v < windows.size() ; ++v){
+    auto& w = windows[v];
+    // a window without recent samples may have ended before now
+    const auto end = std::min(now, w.start + cfg.window);
+    Emit(w, static_cast<JrkVar>(v), end);
+    w.last = std::max(w.last, now); // time to now has been accounted for
+    w.Reset(epoch + (now - epoch) / cfg.window * cfg.window);
+  }
+}
+
+std::vector<RawSample> TelemetryAggregator::Raw() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<RawSample> ret;
+  const auto retained = std::min<uint64_t>(samples, raw.size());
+  for(size_t i = raw.size() - retained ; i < raw.size() ; ++i){
+    ret.push_back(raw[(rawnext + i) % raw.size()]);
+  }
+  return ret;
+}
+
+std::ostream& TelemetryAggregator::DumpRaw(std::ostream& s) {
+  for(const auto& r : Raw()){
+    s << std::chrono::duration_cast<std::chrono::microseconds>(r.when - epoch).count()
+      << "us ";
+    JrkFormatValue(s, JrkDescribe(r.var), r.value) << '\n';
+  }
+  return s;
+}
+
+uint64_t TelemetryAggregator::Samples() {
+  std::lock_guard<std::mutex> guard(lock);
+  return samples;
+}
+
+uint64_t TelemetryAggregator::Summaries() {
+  std::lock_guard<std::mutex> guard(lock);
+  return summaries;
+}
+
+std::ostream& operator<<(std::ostream& s, const WindowSummary& w) {
+  const auto flags = s.flags();
+  s << JrkDescribe(w.var).name << " over "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(w.length).count()
+    << "ms: n=" << w.count << " min=" << w.min << " max=" << w.max
+    << std::fixed << std::setprecision(1) << " mean=" << w.mean
+    << " sd=" << std::sqrt(w.variance);
+  for(size_t i = 0 ; i < TelemetryQuantileCount ; ++i){
+    s << " p" << std::defaultfloat << std::setprecision(3) << TelemetryQuantiles[i] * 100
+      << '=' << std::fixed << std::setprecision(1) << w.quantiles[i];
+  }
+  if(w.thresholded){
+    s << " over threshold "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(w.over).count() << "ms";
+  }
+  s.flags(flags);
+  return s;
+}
+
+}
@@ -0,0 +1,138 @@
+#ifndef POLOLUJRKUSB_LIB_TELEMETRY
+#define POLOLUJRKUSB_LIB_TELEMETRY
+
+#include <mutex>
+#include <array>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include "poller.h"
+
+namespace PololuJrkUSB {
+
+// Streaming estimate of a single quantile in constant memory, using the P²
+// algorithm (Jain & Chlamtac, 1985): five markers track the minimum, the
+// maximum, the quantile, and the quantiles halfway to either side, and are
+// adjusted by piecewise-parabolic interpolation as samples arrive.
+class P2Quantile {
+public:
+  explicit P2Quantile(double p = 0.5);
+
+  void Add(double x);
+  double Value() const; // NaN if no samples have been added
+  void Reset();
+
+private:
+  double p;
+  unsigned count;
+  double q[5];  // marker heights
+  double n[5];  // marker positions
+  double np[5]; // desired marker positions
+  double dn[5]; // increments of desired positions
+};
+
+constexpr double TelemetryQuantiles[] = { 0.5, 0.9, 0.99, };
+constexpr size_t TelemetryQuantileCount = sizeof(TelemetryQuantiles) / sizeof(*TelemetryQuantiles);
+
+// Statistics of one variable over one tumbling window
+struct WindowSummary {
+  JrkVar var;
+  std::chrono::steady_clock::time_point start; // of the window
+  std::chrono::steady_clock::duration length;
+  uint64_t count; // samples
+  int min;
+  int max;
+  double mean;
+  double variance; // population variance
+  std::array<double, TelemetryQuantileCount> quantiles; // TelemetryQuantiles[]
+  bool thresholded; // whether a threshold is set for var
+  std::chrono::steady_clock::duration over; // time above the threshold
+};
+
+std::ostream& operator<<(std::ostream& s, const WindowSummary& w);
+
+struct RawSample {
+  std::chrono::steady_clock::time_point when;
+  JrkVar var;
+  int value;
+};
+
+struct TelemetryConfig {
+  std::chrono::milliseconds window{1000}; // tumbling window length
+  size_t rawsamples = 4096; // samples retained for DumpRaw()
+};
+
+using TelemetrySink = std::function<void(const WindowSummary&)>;
+
+// Aggregates the replies of a single device into per-variable window
+// summaries, delivered to sink as each window closes (with the aggregator's
+// lock held; sink must not call back into it). Nothing else is emitted.
+// Windows are aligned to the aggregator's creation. Time over threshold
+// assumes each sample holds until the next one. A sample stamped earlier
+// than the last of its variable is counted as if it arrived with that one.
+//
+// The most recent cfg.rawsamples samples are retained in a ring, to be
+// dumped after a fault. Memory use is fixed at construction.
+class TelemetryAggregator {
+public:
+  TelemetryAggregator(TelemetrySink sink,
+                      const TelemetryConfig& cfg = TelemetryConfig());
+
+  // Time spent above threshold is reported in var's summaries.
+  void SetThreshold(JrkVar var, int threshold);
+
+  void Record(JrkVar var, int value,
+              std::chrono::steady_clock::time_point when = std::chrono::steady_clock::now());
+
+  // Suitable for Poller::SetReplyCallback()
+  PollerReplyCallback Callback();
+
+  // Emits summaries of all windows in progress, as if they'd closed.
+  void Flush();
+
+  // Copies out the retained raw samples, oldest first.
+  std::vector<RawSample> Raw();
+  std::ostream& DumpRaw(std::ostream& s);
+
+  uint64_t Samples(); // recorded in total
+  uint64_t Summaries(); // emitted in total
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct VariableWindow {
+    VariableWindow();
+    void Reset(clock::time_point start);
+
+    clock::time_point start;
+    uint64_t count;
+    int min;
+    int max;
+    double mean;
+    double m2; // sum of squared differences from the mean (Welford)
+    std::array<P2Quantile, TelemetryQuantileCount> quantiles;
+    bool thresholded;
+    int threshold;
+    clock::duration over;
+    bool above; // the last sample exceeded threshold
+    clock::time_point last; // of the last sample, in any window (or epoch)
+  };
+
+  TelemetrySink sink;
+  const TelemetryConfig cfg;
+  const clock::time_point epoch;
+  std::mutex lock; // guards all below
+  std::array<VariableWindow, JrkVariableCount> windows;
+  std::vector<RawSample> raw; // ring of cfg.rawsamples
+  size_t rawnext;
+  uint64_t samples;
+  uint64_t summaries;
+
+  void Emit(VariableWindow& w, JrkVar var, clock::time_point end);
+};
+
+}
+
+#endif
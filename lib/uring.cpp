@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+using namespace std::literals::string_literals;
+
+namespace PololuJrkUSB {
+
+IoUring::IoUring(unsigned entries) :
+ringfd(-1),
+sqring(MAP_FAILED),
+cqring(MAP_FAILED),
+sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+tosubmit(0) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ringfd = syscall(__NR_io_uring_setup, entries, &params);
+  if(ringfd < 0){
+    throw std::runtime_error("couldn't set up io_uring: "s + strerror(errno));
+  }
+  sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if(single){
+    sqringsize = cqringsize = std::max(sqringsize, cqringsize);
+  }
+  sqring = mmap(nullptr, sqringsize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+  if(sqring == MAP_FAILED){
+    close(ringfd);
+    throw std::runtime_error("couldn't map io_uring: "s + strerror(errno));
+  }
+  if(single){
+    cqring = sqring;
+  }else{
+    cqring = mmap(nullptr, cqringsize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+    if(cqring == MAP_FAILED){
+      munmap(sqring, sqringsize);
+      close(ringfd);
+      throw std::runtime_error("couldn't map io_uring: "s + strerror(errno));
+    }
+  }
+  sqessize = params.sq_entries * sizeof(io_uring_sqe);
+  sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqessize, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES));
+  if(sqes == MAP_FAILED){
+    if(!single){
+      munmap(cqring, cqringsize);
+    }
+    munmap(sqring, sqringsize);
+    close(ringfd);
+    throw std::runtime_error("couldn't map io_uring: "s + strerror(errno));
+  }
+  auto sq = static_cast<char*>(sqring);
+  sqhead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqtail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqmask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqarray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sqentries = params.sq_entries;
+  auto cq = static_cast<char*>(cqring);
+  cqhead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqtail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqmask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  munmap(sqes, sqessize);
+  if(cqring != sqring){
+    munmap(cqring, cqringsize);
+  }
+  munmap(sqring, sqringsize);
+  close(ringfd);
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+  unsigned tail = *sqtail;
+  if(tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries){
+    Enter(false, nullptr);
+    if(tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries){
+      return nullptr;
+    }
+  }
+  const unsigned idx = tail & *sqmask;
+  auto sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqarray[idx] = idx;
+  __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+  ++tosubmit;
+  return sqe;
+}
+
+int IoUring::Enter(bool wait, const __kernel_timespec* timeout) {
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  void* argp = nullptr;
+  size_t argsz = 0;
+  if(wait && timeout){
+    arg.ts = reinterpret_cast<uint64_t>(timeout);
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+  int ret = syscall(__NR_io_uring_enter, ringfd, tosubmit, wait ? 1 : 0,
+                    flags, argp, argsz);
+  if(ret < 0){
+    return -errno;
+  }
+  tosubmit -= ret;
+  return ret;
+}
+
+}
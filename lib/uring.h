@@ -0,0 +1,71 @@
+#ifndef POLOLUJRKUSB_LIB_URING
+#define POLOLUJRKUSB_LIB_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+namespace PololuJrkUSB {
+
+// IORING_OP_READ_MULTISHOT (Linux 6.7) postdates the uapi headers we build
+// against. Kernels lacking it fail the SQE with EINVAL.
+constexpr unsigned char UringOpReadMultishot = 49;
+
+// A minimal io_uring, driven directly through the system calls (we don't
+// depend on liburing). The submission queue is not thread-safe; callers
+// must serialize GetSqe()/Enter().
+class IoUring {
+public:
+  explicit IoUring(unsigned entries); // throws if io_uring is unavailable
+  virtual ~IoUring();
+
+  int Fd() const {
+    return ringfd;
+  }
+
+  // Returns a zeroed SQE, submitting queued SQEs first if the ring is full.
+  io_uring_sqe* GetSqe();
+
+  // Submits queued SQEs. If wait is set, blocks until a CQE is available,
+  // or until timeout elapses (if non-null). Returns the io_uring_enter()
+  // result, or -errno (-ETIME on timeout).
+  int Enter(bool wait, const __kernel_timespec* timeout);
+
+  // Invokes f(const io_uring_cqe&) on each available CQE, returning the
+  // number reaped.
+  template<typename F>
+  unsigned Reap(F&& f) {
+    unsigned n = 0;
+    unsigned head = *cqhead;
+    while(head != __atomic_load_n(cqtail, __ATOMIC_ACQUIRE)){
+      f(cqes[head & *cqmask]);
+      ++head;
+      ++n;
+      __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+    }
+    return n;
+  }
+
+private:
+  int ringfd;
+  void* sqring;
+  size_t sqringsize;
+  void* cqring; // may alias sqring (IORING_FEAT_SINGLE_MMAP)
+  size_t cqringsize;
+  io_uring_sqe* sqes;
+  size_t sqessize;
+  unsigned* sqhead;
+  unsigned* sqtail;
+  unsigned* sqmask;
+  unsigned* sqarray;
+  unsigned sqentries;
+  unsigned* cqhead;
+  unsigned* cqtail;
+  unsigned* cqmask;
+  io_uring_cqe* cqes;
+  unsigned tosubmit;
+};
+
+}
+
+#endif
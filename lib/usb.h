@@ -1,21 +1,59 @@
 #ifndef POLOLUJRKUSB_LIB_USB
 #define POLOLUJRKUSB_LIB_USB
 
+#include <chrono>
 #include <string>
+#include <cstdint>
 #include <iostream>
 #include <libusb.h>
+#include "config.h"
+#include "current.h"
 
 namespace PololuJrkUSB {
 
+// Timeout applied to all of our control transfers
+constexpr unsigned UsbControlTimeoutMs = 1000;
+
 void LibusbVersion(std::ostream& s);
-void LibusbGetTopology(libusb_device* dev, int* bus, int* port);
-void JrkGetFirmwareVersion(libusb_device_handle* dev);
-void JrkGetSerialNumber(libusb_device_handle* dev,
-                        const libusb_device_descriptor* desc);
-void LibusbGetConfig(std::ostream& s, libusb_device_handle* dev);
+// Returns the full sysfs-style topology path, e.g. "1-2.4.1"
+std::string LibusbGetTopology(libusb_device* dev);
+void JrkGetFirmwareVersion(libusb_device_handle* dev, int* major, int* minor);
+// The same, from the bcdDevice of a device descriptor already in hand
+void JrkFirmwareFromBcd(uint16_t bcddevice, int* major, int* minor);
+// Returns the serial number, or an empty string if the device has none
+std::string JrkGetSerialNumber(libusb_device_handle* dev,
+                               const libusb_device_descriptor* desc);
+// Writes the configuration to s, returning a hash of the raw values
+uint32_t LibusbGetConfig(std::ostream& s, libusb_device_handle* dev);
+// PARAMETER_SERIAL_TIMEOUT; 0 means the jrk doesn't expect serial traffic
+std::chrono::milliseconds JrkGetSerialTimeout(libusb_device_handle* dev);
+// The current calibration and limits (see JrkCurrentCalibration), read
+// two parameters per transfer
+JrkCurrentCalibration JrkGetCurrentCalibration(libusb_device_handle* dev);
+// Reads every parameter in JrkConfigParams[], grouping neighbours into
+// shared transfers; the number of transfers made is stored to transfers.
+JrkConfigSnapshot JrkExportConfig(libusb_device_handle* dev, unsigned* transfers = nullptr);
+
+struct JrkConfigApplyStats {
+  unsigned changed;   // params which differed from the device
+  unsigned transfers; // control transfers needed to write them
+};
+
+// Writes whichever params of want differ from the device's configuration,
+// merging neighbours into shared transfers. The configuration is exported
+// first, unless the caller has just done so and passes it as base.
+// Parameters marked "Init" in protocol.h take effect once the jrk is
+// reinitialized or power cycled.
+JrkConfigApplyStats JrkApplyConfig(libusb_device_handle* dev, const JrkConfigSnapshot& want,
+                                   const JrkConfigSnapshot* base = nullptr);
+
 void LibusbGetDesc(std::ostream& s, libusb_device_handle* dev,
                    const libusb_device_descriptor* desc);
-std::string FindACMDevice(int bus, int port);
+// Takes a topology path as returned by LibusbGetTopology()
+std::string FindACMDevice(const std::string& topology);
+// The serial number the kernel read at enumeration, from sysfs, costing no
+// device I/O; an empty string if it can't be read. Takes a topology path.
+std::string SysfsSerialNumber(const std::string& topology);
 
 }
 
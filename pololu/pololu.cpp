@@ -1,145 +1,115 @@
+#include <set>
+#include <list>
+#include <array>
+#include <mutex>
 #include <queue>
+#include <atomic>
+#include <memory>
+#include <chrono>
 #include <string>
 #include <thread>
 #include <cstdio>
 #include <vector>
+#include <poll.h>
 #include <cstring>
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <libusb.h>
 #include <iostream>
 #include <unistd.h>
+#include <algorithm>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include "poller.h"
 #include "usb.h"
+#include "discovery.h"
 
 using namespace std::literals::string_literals;
 
 static void
 usage(std::ostream& os, int ret) {
-  os << "usage: pololu dev\n";
+  os << "usage: pololu [ -l ] [ -d ] [ -u | -b ] [ -w ] [ -m mA ] [ -r mA ] [ -c capture ] [ -x | -i snapshot ] dev\n";
+  os << " -l: low-latency serial transport\n";
+  os << " -d: dump each jrk's configuration, even if it was cached\n";
+  os << " -u: io_uring I/O backend, polled from its own thread\n";
+  os << " -b: print the replies of each event loop turn together\n";
+  os << " -w: keep the jrk's serial timeout fed, reporting lapses\n";
+  os << " -m: monitor current, stopping the motor on any sample over mA\n";
+  os << " -r: monitor current, stopping the motor once its RMS over 1s exceeds mA\n";
+  os << " -c: record all device I/O to capture (see replay)\n";
+  os << " -x: export the configuration to snapshot (text if named *.txt), and exit\n";
+  os << " -i: apply the configuration in snapshot, and exit\n";
   os << std::endl;
   exit(ret);
 }
 
-static bool cancelled = false;
-
-class SplitException : public std::runtime_error {
-public:
-  SplitException(const std::string& what) :
-    std::runtime_error(what) {}
-};
-
-// FIXME rewrite all these with a function object
-static void ReadJrkInput(PololuJrkUSB::Poller& poller,
-                  std::vector<std::string>::iterator begin,
-                  std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
-  }
-  poller.ReadJrkInput();
-}
-
-static void ReadJrkFeedback(PololuJrkUSB::Poller& poller,
-                     std::vector<std::string>::iterator begin,
-                     std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
+// Parses a -m or -r current limit, exiting through usage() unless arg is
+// wholly a number of mA the jrk's 16-bit current reading can reach
+static unsigned
+ParseMilliamps(const char* arg) {
+  char* e;
+  errno = 0;
+  unsigned long ma = strtoul(arg, &e, 10);
+  if(errno || e == arg || *e || *arg == '-' || ma < 1 || ma > 65535){
+    std::cerr << "current limit must be a number of mA [1..65535]: " << arg << std::endl;
+    usage(std::cerr, EXIT_FAILURE);
   }
-  poller.ReadJrkFeedback();
+  return ma;
 }
 
-static void ReadJrkTarget(PololuJrkUSB::Poller& poller,
-                   std::vector<std::string>::iterator begin,
-                   std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
-  }
-  poller.ReadJrkTarget();
-}
+static std::atomic<bool> cancelled(false);
 
-static void ReadJrkScaledFeedback(PololuJrkUSB::Poller& poller,
-                  std::vector<std::string>::iterator begin,
-                  std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
-  }
-  poller.ReadJrkScaledFeedback();
-}
+constexpr std::chrono::milliseconds CurrentSamplePeriod(10);
 
-static void ReadJrkErrorSum(PololuJrkUSB::Poller& poller,
-                     std::vector<std::string>::iterator begin,
-                     std::vector<std::string>::iterator end) {
+// Sends the read command described by var
+static void ReadJrkVariable(PololuJrkUSB::Poller& poller,
+                  const PololuJrkUSB::JrkVariable& var,
+                  char* const* begin, char* const* end) {
   if(begin != end){
     std::cerr << "command does not accept options" << std::endl;
     return;
   }
-  poller.ReadJrkErrorSum();
-}
-
-static void ReadJrkDutyCycleTarget(PololuJrkUSB::Poller& poller,
-                   std::vector<std::string>::iterator begin,
-                   std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
-  }
-  poller.ReadJrkDutyCycleTarget();
-}
-
-static void ReadJrkDutyCycle(PololuJrkUSB::Poller& poller,
-                   std::vector<std::string>::iterator begin,
-                   std::vector<std::string>::iterator end) {
-  if(begin != end){
-    std::cerr << "command does not accept options" << std::endl;
-    return;
-  }
-  poller.ReadJrkDutyCycle();
+  poller.ReadJrk(var.id);
 }
 
 static void SetJrkTarget(PololuJrkUSB::Poller& poller,
-                  std::vector<std::string>::iterator begin,
-                  std::vector<std::string>::iterator end) {
-  if(begin == end || begin + 1 != end){
-    std::cerr << "command requires a single argument [0..4095]" << std::endl;
-    return;
+                  char* const* begin, char* const* end) {
+  char* e;
+  long target = 0;
+  if(begin + 1 == end){
+    errno = 0;
+    target = strtol(*begin, &e, 10);
   }
-  auto target = std::stoi(*begin);
-  if(target < 0 || target > 4095){
+  if(begin + 1 != end || errno || e == *begin || *e || target < 0 || target > 4095){
     std::cerr << "command requires a single argument [0..4095]" << std::endl;
     return;
   }
   poller.SetJrkTarget(target);
 }
 
-static void ReadJrkErrors(PololuJrkUSB::Poller& poller,
-                   std::vector<std::string>::iterator begin,
-                   std::vector<std::string>::iterator end) {
+static void SetJrkOff(PololuJrkUSB::Poller& poller,
+               char* const* begin, char* const* end) {
   if(begin != end){
     std::cerr << "command does not accept options" << std::endl;
     return;
   }
-  poller.ReadJrkErrors();
+  poller.SetJrkOff();
 }
 
-static void SetJrkOff(PololuJrkUSB::Poller& poller,
-               std::vector<std::string>::iterator begin,
-               std::vector<std::string>::iterator end) {
+static void RearmCurrent(PololuJrkUSB::Poller& poller,
+                  char* const* begin, char* const* end) {
   if(begin != end){
     std::cerr << "command does not accept options" << std::endl;
     return;
   }
-  poller.SetJrkOff();
+  poller.ResetCurrentMonitor();
 }
 
 static void StopPolling(PololuJrkUSB::Poller& poller,
-                 std::vector<std::string>::iterator begin,
-                 std::vector<std::string>::iterator end) {
+                 char* const* begin, char* const* end) {
   if(begin != end){
     std::cerr << "command does not accept options" << std::endl;
     return;
@@ -148,47 +118,65 @@ static void StopPolling(PololuJrkUSB::Poller& poller,
   cancelled = true;
 }
 
+// No command takes more than a few arguments
+constexpr size_t MaxTokens = 8;
+using Tokens = std::array<char*, MaxTokens>;
+
 // Split a line into whitespace-delimited tokens, supporting simple quoting
-// using single quotes, plus escaping using backslash.
-static std::vector<std::string>
-SplitInput(const char* line) {
-  std::vector<std::string> tokens;
-  std::vector<char> token;
+// using single quotes, plus escaping using backslash. Tokens are unquoted in
+// place, so line is overwritten, and tokens point into it. Returns nullptr,
+// or a description of the error.
+static const char*
+SplitInput(char* line, Tokens& tokens, size_t& count) {
+  char* w = line; // unquoted bytes are written here, never ahead of line
+  char* token = nullptr;
   bool quoted = false;
   bool escaped = false;
-  int offset = 0;
+  count = 0;
   char c;
-  while( (c = line[offset]) ){
+  auto endtoken = [&](){
+    if(token && w > token){
+      if(count == tokens.size()){
+        return false;
+      }
+      *w++ = '\0';
+      tokens[count++] = token;
+    }
+    token = nullptr;
+    return true;
+  };
+  while( (c = *line++) ){
+    if(token == nullptr){
+      token = w;
+    }
     if(c == '\\' && !escaped){
       escaped = true;
     }else if(escaped){
-      token.push_back(c);
+      *w++ = c;
       escaped = false;
     }else if(quoted){
       if(c == '\''){
         quoted = false;
       }else{
-        token.push_back(c);
+        *w++ = c;
       }
     }else if(isspace(c)){
-      if(token.size()){
-        tokens.emplace_back(std::string(token.begin(), token.end()));
-        token.clear();
+      if(!endtoken()){
+        return "too many arguments";
       }
     }else if(c == '\''){
       quoted = true;
     }else{
-      token.push_back(c);
+      *w++ = c;
     }
-    ++offset;
   }
-  if(token.size()){
-    tokens.emplace_back(std::string(token.begin(), token.end()));
+  if(!endtoken()){
+    return "too many arguments";
   }
   if(quoted){
-    throw SplitException("unterminated single quote");
+    return "unterminated single quote";
   }
-  return tokens;
+  return nullptr;
 }
 
 #define ANSI_WHITE "\033[1;37m"
@@ -196,111 +184,477 @@ SplitInput(const char* line) {
 #define RL_START "\x01" // RL_PROMPT_START_IGNORE
 #define RL_END "\x02"   // RL_PROMPT_END_IGNORE
 
+static const char Prompt[] = RL_START "\033[0;35m" RL_END
+  "[" RL_START "\033[0;36m" RL_END
+  "pololu" RL_START "\033[0;35m" RL_END
+  "] " RL_START ANSI_WHITE RL_END;
+
+static const struct Command {
+  const char* cmd;
+  void (* fxn)(PololuJrkUSB::Poller&, char* const*, char* const*);
+  const char* help;
+} CmdTable[] = {
+  { .cmd = "quit", .fxn = &StopPolling, .help = "exit program", },
+  { .cmd = "settarget", .fxn = &SetJrkTarget, .help = "send set target command (arg: [0..4095])", },
+  { .cmd = "off", .fxn = &SetJrkOff, .help = "send a motor off command", },
+  { .cmd = "rearm", .fxn = &RearmCurrent, .help = "rearm the current monitor after a trip", },
+  { .cmd = "", .fxn = nullptr, .help = "", },
+};
+
+// Runs the command on line, which is freed. A null line (end of input)
+// stops the Poller.
+static void
+HandleLine(PololuJrkUSB::Poller& poller, char* line) {
+  if(line == nullptr){
+    poller.StopPolling();
+    cancelled = true;
+    return;
+  }
+  std::unique_ptr<char, decltype(&free)> owned(line, &free);
+  // history gets the line as typed, before SplitInput() unquotes it
+  if(line[strspn(line, " \t\n\v\f\r")]){
+    add_history(line);
+  }
+  Tokens tokes;
+  size_t count;
+  if(const char* err = SplitInput(line, tokes, count)){
+    std::cerr << err << std::endl;
+    return;
+  }
+  if(count == 0){
+    return;
+  }
+  const Command* c;
+  for(c = CmdTable ; c->fxn ; ++c){
+    if(strcmp(c->cmd, tokes[0]) == 0){
+      (c->fxn)(poller, tokes.data() + 1, tokes.data() + count);
+      break;
+    }
+  }
+  // Read commands are generated from the protocol descriptor table, and
+  // consulted only if CmdTable has no match.
+  const PololuJrkUSB::JrkVariable* var = nullptr;
+  if(c->fxn == nullptr){
+    for(const auto& v : PololuJrkUSB::JrkVariables){
+      if(strcmp(tokes[0], v.cmd) == 0){
+        var = &v;
+        ReadJrkVariable(poller, v, tokes.data() + 1, tokes.data() + count);
+        break;
+      }
+    }
+  }
+  if(c->fxn == nullptr && var == nullptr && strcmp(tokes[0], "help")){
+    std::cerr << "unknown command: " << tokes[0] << std::endl;
+  }else if(c->fxn == nullptr && var == nullptr){ // display help
+    for(c = CmdTable ; c->fxn ; ++c){
+      std::cout << c->cmd << ANSI_GREY " " << c->help << ANSI_WHITE "\n";
+    }
+    for(const auto& v : PololuJrkUSB::JrkVariables){
+      std::cout << v.cmd << ANSI_GREY " " << v.help << " (" << v.units << ")" ANSI_WHITE "\n";
+    }
+    std::cout << "help" ANSI_GREY ": list commands" ANSI_WHITE << std::endl;
+  }
+}
+
+// Blocking readline on this thread, with Poll() running on another
 static void
 ReadlineLoop(PololuJrkUSB::Poller& poller) {
-  const struct {
-    const std::string cmd;
-    void (* fxn)(PololuJrkUSB::Poller&,
-                 std::vector<std::string>::iterator,
-                 std::vector<std::string>::iterator);
-    const char* help;
-  } cmdtable[] = {
-    { .cmd = "quit", .fxn = &StopPolling, .help = "exit program", },
-    { .cmd = "feedback", .fxn = &ReadJrkFeedback, .help = "send a read feedback request", },
-    { .cmd = "target", .fxn = &ReadJrkTarget, .help = "send a read target request", },
-    { .cmd = "input", .fxn = &ReadJrkInput, .help = "send a read input command", },
-    { .cmd = "sfeedback", .fxn = &ReadJrkScaledFeedback, .help = "send a read scaled feedback request", },
-    { .cmd = "errorsum", .fxn = &ReadJrkErrorSum, .help = "send a read error sum request", },
-    { .cmd = "cycletarg", .fxn = &ReadJrkDutyCycleTarget, .help = "send a read duty cycle target command", },
-    { .cmd = "cycle", .fxn = &ReadJrkDutyCycle, .help = "send a read duty cycle command", },
-    { .cmd = "eflags", .fxn = &ReadJrkErrors, .help = "send a read error flags command", },
-    { .cmd = "settarget", .fxn = &SetJrkTarget, .help = "send set target command (arg: [0..4095])", },
-    { .cmd = "off", .fxn = &SetJrkOff, .help = "send a motor off command", },
-    { .cmd = "", .fxn = nullptr, .help = "", },
-  }, *c;
-  char* line;
   while(!cancelled){
-    line = readline(RL_START "\033[0;35m" RL_END
-      "[" RL_START "\033[0;36m" RL_END
-      "pololu" RL_START "\033[0;35m" RL_END
-      "] " RL_START ANSI_WHITE RL_END);
-    if(line == nullptr){
-      poller.StopPolling();
-      break;
+    HandleLine(poller, readline(Prompt));
+  }
+}
+
+// Jrks arriving (or leaving) after startup. The hotplug callback is
+// registered before DiscoverJrks() runs, so that no arrival is missed, and
+// may thus also report jrks which discovery found; those are recognized by
+// their topology. Arrivals are probed on worker threads, as DiscoverJrks()
+// does, since a probe's control transfers may block for seconds; each
+// worker leaves its report in probed, and signals wakefd.
+struct Hotplug {
+  struct Prober {
+    std::thread thread;
+    bool done = false;
+  };
+  libusb_context* ctx;
+  int wakefd = -1; // eventfd, or -1
+  std::mutex lock; // callbacks run within any libusb call, on any thread
+  std::set<std::string> known; // topologies of jrks already reported
+  std::vector<libusb_device*> arrived; // referenced; awaiting ProbeArrivals()
+  std::list<Prober> probers;
+  std::string probed; // reports of finished probes, awaiting printing
+};
+
+static void HandleUsbEvents(Hotplug& hotplug, std::ostream& os);
+
+// Prints text above the line being edited, then redraws the prompt and the
+// line as they were.
+static void
+ReadlinePrint(const std::string& text) {
+  const int point = rl_point;
+  char* saved = rl_copy_text(0, rl_end);
+  rl_save_prompt();
+  rl_replace_line("", 0);
+  rl_redisplay();
+  std::cout << text << std::flush;
+  rl_restore_prompt();
+  rl_replace_line(saved, 0);
+  rl_point = point;
+  rl_redisplay();
+  free(saved);
+}
+
+static PololuJrkUSB::Poller* rlpoller; // for ReadlineHandler()
+
+static void
+ReadlineHandler(char* line) {
+  HandleLine(*rlpoller, line);
+}
+
+// Keyboard input, device I/O, reply deadlines and libusb events, all
+// serviced from this thread: readline is fed a character at a time as stdin
+// becomes readable, and the Poller is driven through Service(). With
+// coalesce, the replies decoded in each turn of the loop are printed
+// together, redrawing the prompt once, rather than once per reply.
+static void
+EventLoop(PololuJrkUSB::Poller& poller, bool coalesce, Hotplug* hotplug) {
+  std::string replies;
+  poller.SetReplyCallback([&replies, coalesce](const PololuJrkUSB::JrkVariable& v, int value){
+    std::ostringstream ss;
+    PololuJrkUSB::JrkFormatValue(ss, v, value) << '\n';
+    if(coalesce){
+      replies += ss.str();
+    }else{
+      ReadlinePrint(ss.str());
     }
-    std::vector<std::string> tokes;
-    try{
-      tokes = SplitInput(line);
-    }catch(SplitException& e){
-      std::cerr << e.what() << std::endl;
-      add_history(line);
-      free(line);
-      continue;
+  });
+  rlpoller = &poller;
+  rl_callback_handler_install(Prompt, ReadlineHandler);
+  std::vector<struct pollfd> pfds = {
+    { .fd = STDIN_FILENO, .events = POLLIN, .revents = 0, },
+    { .fd = poller.DeviceFd(), .events = POLLIN | POLLPRI, .revents = 0, },
+  };
+  // libusb's descriptors don't change unless devices are opened for
+  // asynchronous I/O, which we never do
+  if(hotplug){
+    pfds.push_back({ .fd = hotplug->wakefd, .events = POLLIN, .revents = 0, });
+    auto usbfds = libusb_get_pollfds(hotplug->ctx);
+    for(auto fd = usbfds ; fd && *fd ; ++fd){
+      pfds.push_back({ .fd = (*fd)->fd, .events = (*fd)->events, .revents = 0, });
     }
-    if(tokes.size() == 0){
-      free(line);
+    libusb_free_pollfds(usbfds);
+  }
+  while(!cancelled){
+    if(poll(pfds.data(), pfds.size(), poller.ServiceTimeout()) < 0){
+      if(errno != EINTR){
+        std::cerr << "error polling " << pfds.size() << " fds: " << strerror(errno) << std::endl;
+      }
       continue;
     }
-    add_history(line);
-    for(c = cmdtable ; c->fxn ; ++c){
-      if(c->cmd == tokes[0]){
-        (c->fxn)(poller, tokes.begin() + 1, tokes.end());
-        break;
-      }
+    if(pfds[0].revents){
+      rl_callback_read_char();
     }
-    if(c->fxn == nullptr && tokes[0] != "help"){
-      std::cerr << "unknown command: " << tokes[0] << std::endl;
-    }else if(c->fxn == nullptr){ // display help
-      for(c = cmdtable ; c->fxn ; ++c){
-        std::cout << c->cmd << ANSI_GREY " " << c->help << ANSI_WHITE "\n";
+    poller.Service(pfds[1].revents);
+    if(std::any_of(pfds.begin() + 2, pfds.end(),
+                   [](const struct pollfd& p){ return p.revents; })){
+      uint64_t wakeups;
+      if(pfds[2].revents && read(hotplug->wakefd, &wakeups, sizeof(wakeups)) < 0){
+        // EAGAIN; the count was already taken
       }
-      std::cout << "help" ANSI_GREY ": list commands" ANSI_WHITE << std::endl;
+      std::ostringstream arrivals;
+      HandleUsbEvents(*hotplug, arrivals);
+      replies += arrivals.str();
+    }
+    if(!replies.empty()){
+      ReadlinePrint(replies);
+      replies.clear();
+    }
+  }
+  rl_callback_handler_remove();
+  poller.SetReplyCallback(nullptr);
+}
+
+static void
+PrintJrk(std::ostream& os, const PololuJrkUSB::JrkDeviceInfo& info) {
+  os << "USB device at " << info.topology << (info.warm ? " (cached)" : "") << "\n";
+  if(info.tty.empty()){
+    os << " Couldn't find control TTY\n";
+  }else{
+    os << " Found control TTY: " << info.tty << "\n";
+  }
+  os << info.description << "\n";
+  if(!info.serial.empty()){
+    os << " Serial number: " << info.serial << "\n";
+  }
+  os << " Firmware version: " << info.fwmajor << "." << info.fwminor << "\n";
+  os << info.config;
+  os << " Config hash: " << std::hex << info.confighash << std::dec << std::endl;
+}
+
+// Opens the discovered jrk whose control TTY is dev. Throws on failure.
+static libusb_device_handle*
+OpenJrk(libusb_context* ctx, const PololuJrkUSB::DiscoveryReport& report,
+        const char* dev) {
+  const char* base = strrchr(dev, '/');
+  base = base ? base + 1 : dev;
+  auto info = std::find_if(report.devices.begin(), report.devices.end(),
+                [base](const PololuJrkUSB::JrkDeviceInfo& i){ return i.tty == base; });
+  if(info == report.devices.end()){
+    throw std::runtime_error("no jrk discovered at "s + dev);
+  }
+  libusb_device** list;
+  auto count = libusb_get_device_list(ctx, &list);
+  if(count < 0){
+    throw std::runtime_error("error listing usb devices: "s +
+                             libusb_strerror(static_cast<libusb_error>(count)));
+  }
+  libusb_device_handle* handle = nullptr;
+  int ret = LIBUSB_ERROR_NOT_FOUND;
+  for(ssize_t i = 0 ; i < count ; ++i){
+    if(PololuJrkUSB::LibusbGetTopology(list[i]) == info->topology){
+      ret = libusb_open(list[i], &handle);
+      break;
     }
-    free(line);
   }
+  libusb_free_device_list(list, 1);
+  if(ret){
+    throw std::runtime_error("error opening usb device: "s +
+                             libusb_strerror(static_cast<libusb_error>(ret)));
+  }
+  return handle;
+}
+
+static std::chrono::milliseconds
+SerialTimeout(libusb_context* ctx, const PololuJrkUSB::DiscoveryReport& report,
+              const char* dev) {
+  auto handle = OpenJrk(ctx, report, dev);
+  try{
+    auto timeout = PololuJrkUSB::JrkGetSerialTimeout(handle);
+    libusb_close(handle);
+    return timeout;
+  }catch(...){
+    libusb_close(handle);
+    throw;
+  }
+}
+
+static PololuJrkUSB::JrkCurrentCalibration
+CurrentCalibration(libusb_context* ctx, const PololuJrkUSB::DiscoveryReport& report,
+                   const char* dev) {
+  auto handle = OpenJrk(ctx, report, dev);
+  try{
+    auto cal = PololuJrkUSB::JrkGetCurrentCalibration(handle);
+    libusb_close(handle);
+    return cal;
+  }catch(...){
+    libusb_close(handle);
+    throw;
+  }
+}
+
+// Snapshots whose names end in ".txt" are text, others binary
+static bool
+TextSnapshot(const std::string& path) {
+  return path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
 }
 
-// Return 0 to rearm the callback, or 1 to disable it.
+// Exports the configuration of the jrk at dev to path
+static void
+ExportConfig(libusb_context* ctx, const PololuJrkUSB::DiscoveryReport& report,
+             const char* dev, const std::string& path) {
+  auto handle = OpenJrk(ctx, report, dev);
+  PololuJrkUSB::JrkConfigSnapshot snap;
+  unsigned transfers;
+  try{
+    snap = PololuJrkUSB::JrkExportConfig(handle, &transfers);
+  }catch(...){
+    libusb_close(handle);
+    throw;
+  }
+  libusb_close(handle);
+  std::ofstream out(path, std::ios::binary);
+  if(TextSnapshot(path)){
+    snap.WriteText(out);
+  }else{
+    snap.WriteBinary(out);
+  }
+  if(!out.flush()){
+    throw std::runtime_error("error writing "s + path);
+  }
+  std::cout << "Exported " << PololuJrkUSB::JrkConfigParamCount << " parameters to "
+            << path << " in " << transfers << " transfers" << std::endl;
+}
+
+// Applies the snapshot at path to the jrk at dev. A text snapshot need only
+// name the parameters it sets.
+static void
+ApplyConfig(libusb_context* ctx, const PololuJrkUSB::DiscoveryReport& report,
+            const char* dev, const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if(!in){
+    throw std::runtime_error("couldn't open "s + path);
+  }
+  auto handle = OpenJrk(ctx, report, dev);
+  PololuJrkUSB::JrkConfigApplyStats st;
+  try{
+    // the configuration is exported once, serving as the base of a text
+    // snapshot and as what it's diffed against
+    const auto have = PololuJrkUSB::JrkExportConfig(handle);
+    auto want = have;
+    if(TextSnapshot(path)){
+      want.ReadText(in);
+    }else{
+      want.ReadBinary(in);
+    }
+    st = PololuJrkUSB::JrkApplyConfig(handle, want, &have);
+  }catch(...){
+    libusb_close(handle);
+    throw;
+  }
+  libusb_close(handle);
+  std::cout << "Applied " << path << ": " << st.changed << " of "
+            << PololuJrkUSB::JrkConfigParamCount << " parameters changed, written in "
+            << st.transfers << " transfers (saved " << PololuJrkUSB::JrkConfigParamCount - st.transfers
+            << " against a full write, " << st.changed - st.transfers
+            << " against one per change)" << std::endl;
+}
+
+// Return 0 to rearm the callback, or 1 to disable it. libusb forbids I/O
+// from its callbacks, so arrivals are only queued here, for ProbeArrivals().
 static int
 libusb_callback(libusb_context *ctx, libusb_device *dev,
                 libusb_hotplug_event event, void *user_data) {
-  (void)ctx; (void)user_data;
-  if(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED != event){
-    std::cerr << "unexpected libusb event " << event << std::endl;
+  (void)ctx;
+  auto hotplug = static_cast<Hotplug*>(user_data);
+  std::lock_guard<std::mutex> guard(hotplug->lock);
+  if(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED == event){
+    hotplug->arrived.push_back(libusb_ref_device(dev));
+  }else if(LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == event){
+    try{
+      hotplug->known.erase(PololuJrkUSB::LibusbGetTopology(dev));
+    }catch(std::runtime_error&){
+      // it can't have been probed, then
+    }
   }else{
+    std::cerr << "unexpected libusb event " << event << std::endl;
+  }
+  return 0;
+}
+
+// Starts probing the jrks which arrived since last called, skipping any
+// already reported, and joins the probers which have finished.
+static void
+ProbeArrivals(Hotplug& hotplug) {
+  std::vector<libusb_device*> arrived;
+  std::list<Hotplug::Prober> finished;
+  {
+    std::lock_guard<std::mutex> guard(hotplug.lock);
+    arrived.swap(hotplug.arrived);
+    for(auto it = hotplug.probers.begin() ; it != hotplug.probers.end() ; ){
+      auto next = std::next(it);
+      if(it->done){
+        finished.splice(finished.end(), hotplug.probers, it);
+      }
+      it = next;
+    }
+  }
+  for(auto& p : finished){
+    p.thread.join();
+  }
+  for(auto dev : arrived){
     struct libusb_device_descriptor desc;
     auto ret = libusb_get_device_descriptor(dev, &desc);
     if(ret){
-      throw std::runtime_error("error describing usb device: "s +
-                               libusb_strerror(static_cast<libusb_error>(ret)));
-    }
-    if(desc.idVendor != PololuJrkUSB::PololuVendorID){
+      std::cerr << "error describing usb device: "
+                << libusb_strerror(static_cast<libusb_error>(ret)) << std::endl;
+    }else if(desc.idVendor != PololuJrkUSB::PololuVendorID){
       std::cerr << "unexpected idVendor " << desc.idVendor << std::endl;
     }else if(desc.idProduct != PololuJrkUSB::Jrk21v3ProductID &&
              desc.idProduct != PololuJrkUSB::Jrk12v12ProductID){
-      std::cout << "unsupported idProduct " << desc.idProduct << std::endl;
+      std::cerr << "unsupported idProduct " << desc.idProduct << std::endl;
     }else{
-      libusb_device_handle* handle;
-      if( (ret = libusb_open(dev, &handle)) ){
-        throw std::runtime_error("error opening usb device: "s +
-                                libusb_strerror(static_cast<libusb_error>(ret)));
-      }
-      int bus, port;
-      PololuJrkUSB::LibusbGetTopology(dev, &bus, &port);
       try{
-        auto devtty = PololuJrkUSB::FindACMDevice(bus, port);
-        std::cout << " Found control TTY: " << devtty << std::endl;
-      }catch(std::runtime_error& e){ // FIXME clamp down on acceptable errors
-        std::cerr << "Couldn't find control TTY: " << e.what() << std::endl;
+        const auto topology = PololuJrkUSB::LibusbGetTopology(dev);
+        bool fresh;
+        {
+          std::lock_guard<std::mutex> guard(hotplug.lock);
+          fresh = hotplug.known.insert(topology).second;
+        }
+        if(fresh){
+          std::lock_guard<std::mutex> guard(hotplug.lock);
+          hotplug.probers.emplace_back();
+          auto p = &hotplug.probers.back();
+          // the worker takes over our reference to dev
+          p->thread = std::thread([&hotplug, p, dev, desc](){
+            std::ostringstream os;
+            try{
+              PrintJrk(os, PololuJrkUSB::ProbeJrk(dev, desc, nullptr));
+            }catch(std::runtime_error& e){
+              std::cerr << "error probing jrk: " << e.what() << std::endl;
+            }
+            libusb_unref_device(dev);
+            std::lock_guard<std::mutex> guard(hotplug.lock);
+            hotplug.probed += os.str();
+            p->done = true;
+            const uint64_t one = 1;
+            if(hotplug.wakefd >= 0 && write(hotplug.wakefd, &one, sizeof(one)) < 0){
+              // the count saturated, so a wakeup is pending anyway
+            }
+          });
+          continue;
+        }
+      }catch(std::runtime_error& e){
+        std::cerr << "error probing jrk: " << e.what() << std::endl;
       }
-      PololuJrkUSB::LibusbGetDesc(std::cout, handle, &desc);
-      PololuJrkUSB::JrkGetSerialNumber(handle, &desc);
-      PololuJrkUSB::JrkGetFirmwareVersion(handle);
-      PololuJrkUSB::LibusbGetConfig(std::cout, handle);
-      libusb_close(handle); // FIXME
     }
+    libusb_unref_device(dev);
   }
-  return 0;
+}
+
+// Dispatches whatever libusb events are pending, without blocking, starts
+// probing any resulting arrivals, and prints the reports of probes which
+// have finished.
+static void
+HandleUsbEvents(Hotplug& hotplug, std::ostream& os) {
+  struct timeval zero = { 0, 0, };
+  libusb_handle_events_timeout_completed(hotplug.ctx, &zero, nullptr);
+  ProbeArrivals(hotplug);
+  std::lock_guard<std::mutex> guard(hotplug.lock);
+  os << hotplug.probed;
+  hotplug.probed.clear();
+}
+
+// Dispatches libusb events until cancelled, for when readline blocks the
+// main thread
+static void
+UsbEventLoop(Hotplug& hotplug) {
+  while(!cancelled){
+    struct timeval tv = { 0, 100000, };
+    libusb_handle_events_timeout_completed(hotplug.ctx, &tv, nullptr);
+    ProbeArrivals(hotplug);
+    std::lock_guard<std::mutex> guard(hotplug.lock);
+    std::cout << hotplug.probed << std::flush;
+    hotplug.probed.clear();
+  }
+}
+
+static void
+CloseUsb(libusb_context* ctx, libusb_hotplug_callback_handle* cbhandle, Hotplug& hotplug) {
+  if(cbhandle){
+    libusb_hotplug_deregister_callback(ctx, *cbhandle);
+  }
+  // probes still running must finish before the context goes away
+  for(auto& p : hotplug.probers){
+    p.thread.join();
+  }
+  hotplug.probers.clear();
+  for(auto dev : hotplug.arrived){
+    libusb_unref_device(dev);
+  }
+  hotplug.arrived.clear();
+  if(hotplug.wakefd >= 0){
+    close(hotplug.wakefd);
+  }
+  libusb_exit(ctx);
 }
 
 static void
@@ -309,8 +663,35 @@ PollerReadlineCallback() {
 }
 
 // FIXME it looks like we can maybe get firmware version with 0x060100
-int main(int argc, const char** argv) {
-  if(argc != 2){
+int main(int argc, char** argv) {
+  auto transport = PololuJrkUSB::PollerTransport::Default;
+  auto backend = PololuJrkUSB::PollerBackend::Poll;
+  const char* capture = nullptr;
+  bool heartbeat = false;
+  PololuJrkUSB::CurrentMonitorConfig currentcfg;
+  bool coalesce = false;
+  bool dumpconfig = false;
+  const char* exportpath = nullptr;
+  const char* applypath = nullptr;
+  int opt;
+  while((opt = getopt(argc, argv, "ldubwm:r:c:x:i:")) != -1){
+    switch(opt){
+      case 'l': transport = PololuJrkUSB::PollerTransport::LowLatency; break;
+      case 'd': dumpconfig = true; break;
+      case 'u': backend = PololuJrkUSB::PollerBackend::IoUring; break;
+      case 'b': coalesce = true; break;
+      case 'w': heartbeat = true; break;
+      case 'm': currentcfg.overcurrent_ma = ParseMilliamps(optarg); break;
+      case 'r': currentcfg.rated_ma = ParseMilliamps(optarg); break;
+      case 'c': capture = optarg; break;
+      case 'x': exportpath = optarg; break;
+      case 'i': applypath = optarg; break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  // Only the poll backend can be driven from our own event loop
+  const bool threaded = backend == PololuJrkUSB::PollerBackend::IoUring;
+  if(argc - optind != 1 || (threaded && coalesce) || (exportpath && applypath)){
     usage(std::cerr, EXIT_FAILURE);
   }
 
@@ -322,35 +703,135 @@ int main(int argc, const char** argv) {
               << libusb_strerror(static_cast<libusb_error>(e)) << std::endl;
     return EXIT_FAILURE;
   }
-  // Register a callback for any Pololu device that is already registered, or
-  // happens to show up (FIXME handle departures). We filter by productID
-  // within the callback proper
+  // Register a callback for any Pololu device that shows up from here on.
+  // We filter by productID when probing.
+  Hotplug hotplug;
+  hotplug.ctx = usbctx;
+  hotplug.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(hotplug.wakefd < 0){
+    std::cerr << "error creating eventfd: " << strerror(errno) << std::endl;
+  }
   libusb_hotplug_callback_handle cbhandle;
   auto ret = libusb_hotplug_register_callback(usbctx,
-                                   LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
-                                   LIBUSB_HOTPLUG_ENUMERATE,
+                                   LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                                   LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                   0, // DiscoverJrks() handles those present
                                    PololuJrkUSB::PololuVendorID,
                                    LIBUSB_HOTPLUG_MATCH_ANY, // productID
                                    LIBUSB_HOTPLUG_MATCH_ANY, // class
-                                   libusb_callback, nullptr, &cbhandle);
-  if(ret){
-    throw std::runtime_error("error registering libusb callback: "s +
-                             libusb_strerror(static_cast<libusb_error>(ret)));
+                                   libusb_callback, &hotplug, &cbhandle);
+  const bool hotplugging = ret == 0;
+  if(!hotplugging){
+    std::cerr << "error registering libusb callback: "
+              << libusb_strerror(static_cast<libusb_error>(ret)) << std::endl;
   }
+  // Probe all jrks already present in parallel, validating against what we
+  // found last time where possible.
+  PololuJrkUSB::DiscoveryReport report{};
+  try{
+    report = PololuJrkUSB::DiscoverJrks(usbctx, PololuJrkUSB::DefaultDiscoveryCachePath(),
+                                         dumpconfig);
+  }catch(std::runtime_error& e){
+    std::cerr << "error discovering jrks: " << e.what() << std::endl;
+  }
+  for(const auto& info : report.devices){
+    PrintJrk(std::cout, info);
+  }
+  {
+    std::lock_guard<std::mutex> guard(hotplug.lock);
+    for(const auto& info : report.devices){
+      hotplug.known.insert(info.topology);
+    }
+  }
+  for(const auto& err : report.errors){
+    std::cerr << "error probing jrk: " << err << std::endl;
+  }
+  std::cout << "Discovered " << report.devices.size() << " jrk(s) ("
+            << report.warm << " cached) in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(report.elapsed).count()
+            << "us" << std::endl;
 
-  // Open the USB serial device, and put it in raw, nonblocking mode
   const char* dev = argv[argc - 1];
-  PololuJrkUSB::Poller poller(dev, PollerReadlineCallback);
+  if(exportpath || applypath){
+    int status = EXIT_SUCCESS;
+    try{
+      if(exportpath){
+        ExportConfig(usbctx, report, dev, exportpath);
+      }else{
+        ApplyConfig(usbctx, report, dev, applypath);
+      }
+    }catch(std::runtime_error& e){
+      std::cerr << e.what() << std::endl;
+      status = EXIT_FAILURE;
+    }
+    CloseUsb(usbctx, hotplugging ? &cbhandle : nullptr, hotplug);
+    return status;
+  }
+
+  // Open the USB serial device, and put it in raw, nonblocking mode
+  PololuJrkUSB::Poller poller(dev, threaded ? PollerReadlineCallback : nullptr,
+                              transport, backend);
+  std::cout << "Opened Pololu jrk " << dev << " at fd " << poller.DeviceFd() << std::endl;
+  if(capture){
+    poller.StartCapture(capture);
+  }
+  if(heartbeat){
+    try{
+      auto timeout = SerialTimeout(usbctx, report, dev);
+      if(timeout.count() == 0){
+        std::cerr << "jrk has no serial timeout configured" << std::endl;
+      }else{
+        std::cout << "Heartbeat for serial timeout of " << timeout.count() << "ms" << std::endl;
+        poller.SetHeartbeat(timeout, [](std::chrono::nanoseconds silence){
+          std::cerr << "missed heartbeat: nothing written for "
+                    << silence.count() / 1000000 << "ms" << std::endl;
+        });
+      }
+    }catch(std::runtime_error& e){
+      std::cerr << "couldn't set up heartbeat: " << e.what() << std::endl;
+    }
+  }
+  if(currentcfg.overcurrent_ma || currentcfg.rated_ma){
+    try{
+      auto cal = CurrentCalibration(usbctx, report, dev);
+      std::cout << "Monitoring current every " << CurrentSamplePeriod.count()
+                << "ms (" << cal.forward << "/" << cal.reverse << " mA per unit)" << std::endl;
+      poller.SetCurrentMonitor(cal, currentcfg, CurrentSamplePeriod,
+                               [](PololuJrkUSB::CurrentTrip trip, unsigned milliamps){
+        std::cerr << "motor stopped: " << PololuJrkUSB::CurrentTripName(trip)
+                  << " at " << milliamps << "mA" << std::endl;
+      });
+    }catch(std::runtime_error& e){
+      std::cerr << "couldn't set up current monitor: " << e.what() << std::endl;
+    }
+  }
 
   poller.ReadJrkErrors();
   poller.ReadJrkTarget();
-  std::thread usb(&PololuJrkUSB::Poller::Poll, std::ref(poller));
-  ReadlineLoop(poller);
-  std::cout << "Joining USB poller thread..." << std::endl;
-  usb.join();
+  if(threaded){
+    std::thread usb(&PololuJrkUSB::Poller::Poll, std::ref(poller));
+    std::thread usbevents;
+    if(hotplugging){
+      usbevents = std::thread(UsbEventLoop, std::ref(hotplug));
+    }
+    ReadlineLoop(poller);
+    std::cout << "Joining USB poller thread..." << std::endl;
+    usb.join();
+    if(usbevents.joinable()){
+      usbevents.join();
+    }
+  }else{
+    EventLoop(poller, coalesce, hotplugging ? &hotplug : nullptr);
+  }
 
-  libusb_hotplug_deregister_callback(usbctx, cbhandle);
-  libusb_exit(usbctx);
+  if(capture){
+    try{
+      poller.StopCapture();
+    }catch(std::runtime_error& e){
+      std::cerr << e.what() << std::endl;
+    }
+  }
+  CloseUsb(usbctx, hotplugging ? &cbhandle : nullptr, hotplug);
 
   return EXIT_SUCCESS;
 }
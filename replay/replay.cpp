@@ -0,0 +1,175 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include <stdexcept>
+#include "capture.h"
+#include "protocol.h"
+
+using namespace PololuJrkUSB;
+
+// Feeds a capture recorded with "pololu -c" back through the decoder, either
+// printing what was exchanged (optionally at the recorded pace), or quietly
+// and repeatedly as a decode benchmark.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: replay [ -r ] [ -x ] [ -q ] [ -n passes ] capture\n";
+  os << " -r: replay at the recorded pace rather than maximum speed\n";
+  os << " -x: dump each record in hex\n";
+  os << " -q: don't print commands or replies\n";
+  os << " -n: decode the capture this many times, reporting throughput\n";
+  os << std::endl;
+  exit(ret);
+}
+
+struct ReplayTotals {
+  uint64_t commands;
+  uint64_t replies;
+  uint64_t unclaimed; // reply bytes with no read outstanding
+  uint64_t unknown;   // written bytes which didn't parse as commands
+  uint64_t resyncs;
+  long sum; // of decoded values, so the benchmark can't be optimized out
+};
+
+static std::ostream& Stamp(std::ostream& os, std::chrono::nanoseconds when) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(when).count();
+  return os << '[' << std::setw(6) << us / 1000000 << '.' << std::setfill('0')
+            << std::setw(6) << us % 1000000 << std::setfill(' ') << "] ";
+}
+
+static void Replay(const std::vector<CaptureRecord>& recs, bool paced,
+                   bool hex, bool quiet, ReplayTotals& t) {
+  JrkCommandParser parser;
+  JrkDecoder decoder;
+  const auto start = std::chrono::steady_clock::now();
+  for(const auto& rec : recs){
+    if(paced){
+      std::this_thread::sleep_until(start + rec.when);
+    }
+    if(hex){
+      Stamp(std::cout, rec.when) << (rec.kind == CaptureKind::Write ? "tx" :
+                                    rec.kind == CaptureKind::Read ? "rx" : "drain");
+      if(rec.data.size()){
+        std::cout << " 0x";
+        for(auto b : rec.data){
+          std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)b;
+        }
+        std::cout << std::dec << std::setfill(' ');
+      }
+      std::cout << '\n';
+    }
+    switch(rec.kind){
+      case CaptureKind::Write:
+        parser.Feed(rec.data.data(), rec.data.size(),
+          [&](JrkCommandKind kind, int arg){
+            if(kind == JrkCommandKind::Unknown){
+              ++t.unknown;
+              return;
+            }
+            ++t.commands;
+            switch(kind){
+              case JrkCommandKind::Read:
+                decoder.Sent(static_cast<JrkVar>(arg));
+                break;
+              case JrkCommandKind::SetTarget:
+                if(!quiet){
+                  Stamp(std::cout, rec.when) << "set target " << arg << '\n';
+                }
+                break;
+              case JrkCommandKind::MotorOff:
+                if(!quiet){
+                  Stamp(std::cout, rec.when) << "motor off\n";
+                }
+                break;
+              case JrkCommandKind::Unknown:
+                break;
+            }
+          });
+        break;
+      case CaptureKind::Read:
+        t.unclaimed += decoder.Feed(rec.data.data(), rec.data.size(),
+          [&](const JrkVariable& v, int val){
+            ++t.replies;
+            t.sum += val;
+            if(!quiet){
+              JrkFormatValue(Stamp(std::cout, rec.when), v, val) << '\n';
+            }
+          });
+        break;
+      case CaptureKind::Resync:
+        // The Poller abandoned everything outstanding; so do we
+        ++t.resyncs;
+        decoder.Reset();
+        if(!quiet){
+          Stamp(std::cout, rec.when) << "resynchronized, dropping "
+                                     << rec.data.size() << " bytes\n";
+        }
+        break;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  bool paced = false, hex = false, quiet = false;
+  long passes = 1;
+  int opt;
+  while((opt = getopt(argc, argv, "rxqn:")) != -1){
+    switch(opt){
+      case 'r': paced = true; break;
+      case 'x': hex = true; break;
+      case 'q': quiet = true; break;
+      case 'n': passes = atol(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc - optind != 1 || passes < 1){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  if(passes > 1){
+    quiet = true;
+    hex = false;
+  }
+
+  std::vector<CaptureRecord> recs;
+  uint64_t bytesout = 0, bytesin = 0;
+  try{
+    CaptureReader reader(argv[optind]);
+    CaptureRecord rec;
+    while(reader.Next(rec)){
+      (rec.kind == CaptureKind::Write ? bytesout : bytesin) += rec.data.size();
+      recs.push_back(rec);
+    }
+  }catch(std::runtime_error& e){
+    std::cerr << "error reading capture: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ReplayTotals t{};
+  const auto start = std::chrono::steady_clock::now();
+  for(long p = 0 ; p < passes ; ++p){
+    Replay(recs, paced, hex, quiet, t);
+  }
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+  std::cout << std::flush;
+
+  const auto span = recs.empty() ? std::chrono::nanoseconds(0) : recs.back().when;
+  std::cerr << recs.size() << " records, " << bytesout << " bytes out, "
+            << bytesin << " bytes in over "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(span).count()
+            << "ms" << std::endl;
+  std::cerr << t.commands / passes << " commands, " << t.replies / passes
+            << " replies, " << t.unclaimed / passes << " unclaimed, "
+            << t.unknown / passes << " unparsed, " << t.resyncs / passes
+            << " resyncs (checksum " << t.sum / passes << ")" << std::endl;
+  if(passes > 1 && t.replies){
+    std::cerr << passes << " passes in " << ns / 1000000 << "ms: "
+              << static_cast<double>(ns) / t.replies << " ns/reply, "
+              << static_cast<uint64_t>(t.replies * 1e9 / ns) << " replies/s" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#include <thread>
+#include <cstdlib>
+#include <iostream>
+#include "adaptive.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Drives an emulated jrk through parked, moving, parked, and error phases
+// under the AdaptivePoller, and reports the bandwidth it saved relative to
+// constant full-rate sampling.
+
+static void Phase(const char* name, int ms) {
+  std::cout << name << " (" << ms << "ms)" << std::endl;
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int main(void){
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr);
+  AdaptivePoller ap(p);
+  p.SetReplyCallback([&ap](const JrkVariable& var, int val){
+      ap.OnReply(var, val);
+    });
+  std::thread usb(&Poller::Poll, std::ref(p));
+  std::thread sched(&AdaptivePoller::Run, std::ref(ap));
+
+  Phase("parked", 2000);
+  ap.SetJrkTarget(3000);
+  Phase("moving, then parked", 3000);
+  emu.InjectErrors(0x0040); // AmpsExceeded
+  Phase("error edge, then parked", 2000);
+
+  ap.Stop();
+  sched.join();
+  p.StopPolling();
+  usb.join();
+
+  if(!ap.Error().empty()){
+    return EXIT_FAILURE; // already reported
+  }
+  auto s = ap.Stats();
+  auto ps = p.Stats();
+  std::cout << "full samples: " << s.full_samples << " heartbeats: " << s.heartbeats
+            << " bursts: " << s.bursts << std::endl;
+  std::cout << "bytes on wire: " << ps.bytes_out + ps.bytes_in << " (scheduled "
+            << s.bytes << ") baseline: " << s.baseline_bytes << std::endl;
+  std::cout << "baseline rate: " << s.baseline_bytes / s.seconds << " B/s, adaptive rate: "
+            << s.bytes / s.seconds << " B/s, saved: " << s.BytesPerSecSaved() << " B/s" << std::endl;
+  return 0;
+}
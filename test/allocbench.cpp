@@ -0,0 +1,155 @@
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include <condition_variable>
+#include "poller.h"
+#include "emulator.h"
+#include "allochook.h"
+
+using namespace PololuJrkUSB;
+
+// Checks that the Poller allocates nothing once its reads are reserved.
+// Against an emulated jrk, each backend is driven with a mix of reads
+// (completed through a small-capture callback), set targets and motor offs,
+// keeping a window of reads outstanding, while every allocation in the
+// process is counted from before polling starts, so lazy first-use
+// allocations are caught too. With -w, counting instead starts after a
+// warmup, measuring only the steady state. Reports allocations per million
+// commands, and exits nonzero if there were any.
+
+constexpr int Window = 32;
+constexpr int Warmup = 10000;
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: allocbench [ -n commands ] [ -a ] [ -w ]\n";
+  os << " -n: commands per backend (default 1000000)\n";
+  os << " -a: abort with a backtrace at the first allocation\n";
+  os << " -w: count only after a warmup of " << Warmup << " commands\n";
+  os << std::endl;
+  exit(ret);
+}
+
+struct Flow {
+  std::mutex lock;
+  std::condition_variable cv;
+  int outstanding = 0;
+  int failed = 0;
+};
+
+// Issues commands, one read in every four, keeping at most Window reads
+// outstanding, and waits for all of them to complete.
+static void Drive(Poller& p, Flow& flow, int commands) {
+  auto done = [f = &flow](const JrkVariable&, int, int err){
+    std::lock_guard<std::mutex> guard(f->lock);
+    --f->outstanding;
+    f->failed += !!err;
+    f->cv.notify_one();
+  };
+  for(int i = 0 ; i < commands ; ++i){
+    switch(i % 4){
+      case 0:
+        {
+          std::unique_lock<std::mutex> lk(flow.lock);
+          flow.cv.wait(lk, [&flow]{ return flow.outstanding < Window; });
+          ++flow.outstanding;
+        }
+        p.ReadJrk(i % 8 ? JrkVar::Feedback : JrkVar::Current, done);
+        break;
+      case 3:
+        if(i % 64 == 3){
+          p.SetJrkOff();
+          break;
+        }
+        // fall through
+      default:
+        p.SetJrkTarget(i % 4096);
+        break;
+    }
+  }
+  std::unique_lock<std::mutex> lk(flow.lock);
+  flow.cv.wait(lk, [&flow]{ return flow.outstanding == 0; });
+}
+
+static uint64_t Bench(PollerBackend backend, int commands, bool strict, bool warm,
+                      int& failed) {
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency, backend);
+  p.ReserveReads(Window);
+  Flow flow;
+  // The thread is created (which allocates its state) before counting
+  // starts, but doesn't enter Poll() until after.
+  std::atomic<bool> start(false);
+  std::thread usb([&p, &start]{
+    while(!start){
+      std::this_thread::yield();
+    }
+    p.Poll();
+  });
+  if(warm){
+    start = true;
+    Drive(p, flow, Warmup);
+    AllocHook::Arm(strict);
+  }else{
+    AllocHook::Arm(strict);
+    start = true;
+  }
+  Drive(p, flow, commands);
+  const auto allocs = AllocHook::Disarm();
+  p.StopPolling();
+  usb.join();
+  failed = flow.failed;
+  return allocs;
+}
+
+int main(int argc, char** argv) {
+  int commands = 1000000;
+  bool strict = false;
+  bool warm = false;
+  int opt;
+  while((opt = getopt(argc, argv, "n:aw")) != -1){
+    switch(opt){
+      case 'n': commands = atoi(optarg); break;
+      case 'a': strict = true; break;
+      case 'w': warm = true; break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || commands <= 0){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  const struct {
+    const char* name;
+    PollerBackend backend;
+  } cases[] = {
+    { "poll", PollerBackend::Poll, },
+    { "io_uring", PollerBackend::IoUring, },
+  };
+  bool ok = true;
+  for(const auto& c : cases){
+    uint64_t allocs;
+    int failed;
+    try{
+      allocs = Bench(c.backend, commands, strict, warm, failed);
+    }catch(std::runtime_error& e){
+      std::cerr << c.name << ": " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << std::fixed << std::setprecision(2) << c.name << ": "
+              << allocs * 1e6 / commands << " allocations per 1M commands";
+    if(failed){
+      std::cout << " (" << failed << " reads failed)";
+    }
+    std::cout << std::endl;
+    ok &= allocs == 0 && failed == 0;
+  }
+  if(!ok){
+    std::cerr << "the Poller allocated (or failed) after reserving its reads" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
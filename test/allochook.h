@@ -0,0 +1,108 @@
+#ifndef POLOLUJRKUSB_TEST_ALLOCHOOK
+#define POLOLUJRKUSB_TEST_ALLOCHOOK
+
+// Replaces the global operator new and delete with versions counting every
+// allocation made while armed, by any thread. Armed strictly, the first
+// allocation prints a backtrace and aborts, pointing at its culprit. Include
+// from exactly one translation unit of a benchmark, since it defines the
+// replacements.
+
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <execinfo.h>
+
+namespace AllocHook {
+
+static std::atomic<bool> armed(false);
+static std::atomic<bool> strict(false);
+static std::atomic<uint64_t> count(0);
+
+inline void Arm(bool abortonalloc = false) {
+  count = 0;
+  strict = abortonalloc;
+  armed = true;
+}
+
+// Returns the allocations made since Arm()
+inline uint64_t Disarm() {
+  armed = false;
+  return count;
+}
+
+inline void* Allocate(size_t n, size_t align = 0) {
+  if(armed){
+    ++count;
+    if(strict){
+      armed = false;
+      static const char msg[] = "allocation on the hot path:\n";
+      if(::write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0){
+        // nothing to be done; we're aborting anyway
+      }
+      void* frames[32];
+      backtrace_symbols_fd(frames, backtrace(frames, 32), STDERR_FILENO);
+      abort();
+    }
+  }
+  if(n == 0){
+    n = 1;
+  }
+  return align ? aligned_alloc(align, (n + align - 1) / align * align) : malloc(n);
+}
+
+}
+
+void* operator new(size_t n) {
+  if(void* p = AllocHook::Allocate(n)){
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t n) {
+  return operator new(n);
+}
+void* operator new(size_t n, std::align_val_t a) {
+  if(void* p = AllocHook::Allocate(n, static_cast<size_t>(a))){
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t n, std::align_val_t a) {
+  return operator new(n, a);
+}
+void* operator new(size_t n, const std::nothrow_t&) noexcept {
+  return AllocHook::Allocate(n);
+}
+void* operator new[](size_t n, const std::nothrow_t&) noexcept {
+  return AllocHook::Allocate(n);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include <random>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <iterator>
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+#include "config.h"
+
+using namespace PololuJrkUSB;
+
+// Applies config snapshots to a simulated jrk EEPROM, driven through the
+// same vendor requests JrkExportConfig() and JrkApplyConfig() make. For
+// diffs of increasing size, reports the transfers needed, against writing
+// every parameter and against writing each changed parameter alone, and
+// checks the EEPROM byte for byte at every parameter's offset against the
+// snapshot. Also round-trips snapshots through the binary and text forms,
+// and reports their sizes. Exits nonzero on any mismatch, or on any
+// transfer the firmware isn't known to accept.
+
+constexpr int Trials = 1000;
+
+// The only params one transfer may cover together, per the consecutive
+// pairs marked in protocol.h; listed here independently of config.h.
+constexpr JrkConfigParam Pairs[] = {
+  JrkConfigParam::PARAMETER_MOTOR_MAX_CURRENT_FORWARD,
+  JrkConfigParam::PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD,
+};
+
+// The jrk's EEPROM, addressed by parameter id. A SET_PARAMETER carries its
+// value in wValue, and wIndex is (width << 8) | id; a GET_PARAMETER reads
+// wLength bytes from wIndex. Each transfer is checked to start at a param,
+// to cover whole params, and to cover two only if they're one of Pairs.
+struct Eeprom {
+  unsigned char bytes[256] = {};
+  unsigned transfers = 0;
+  bool valid = true;
+
+  void Check(unsigned id, unsigned width) {
+    const auto idx = JrkConfigIndex(static_cast<JrkConfigParam>(id));
+    if(width < 1 || width > 2 || idx == JrkConfigParamCount){
+      valid = false;
+    }else if(width != JrkConfigParams[idx].bytes){
+      valid &= width == 2 && JrkConfigParams[idx].bytes == 1 &&
+               std::find(std::begin(Pairs), std::end(Pairs),
+                         static_cast<JrkConfigParam>(id)) != std::end(Pairs);
+    }
+    ++transfers;
+  }
+
+  void SetParameter(unsigned wvalue, unsigned windex) {
+    const unsigned id = windex & 0xff;
+    const unsigned width = windex >> 8u;
+    Check(id, width);
+    for(unsigned b = 0 ; b < width && id + b < sizeof(bytes) ; ++b){
+      bytes[id + b] = (wvalue >> (8 * b)) & 0xff;
+    }
+  }
+
+  void GetParameter(unsigned windex, unsigned char* data, unsigned wlength) {
+    Check(windex, wlength);
+    for(unsigned b = 0 ; b < wlength && windex + b < sizeof(bytes) ; ++b){
+      data[b] = bytes[windex + b];
+    }
+  }
+
+  // As JrkExportConfig() does it
+  JrkConfigSnapshot Export() {
+    std::vector<size_t> all(JrkConfigParamCount);
+    for(size_t i = 0 ; i < all.size() ; ++i){
+      all[i] = i;
+    }
+    JrkConfigSnapshot snap;
+    for(const auto& t : JrkConfigGroup(all)){
+      unsigned char data[JrkConfigTransferMax];
+      GetParameter(t.offset, data, t.bytes);
+      snap.Unpack(t, data);
+    }
+    return snap;
+  }
+
+  // As JrkApplyConfig() does it, returning the transfers made
+  unsigned Apply(const JrkConfigSnapshot& want) {
+    const auto plan = JrkConfigGroup(Export().Differences(want));
+    for(const auto& t : plan){
+      SetParameter(want.Pack(t), (t.bytes << 8u) | t.offset);
+    }
+    return plan.size();
+  }
+
+  // Whether every param's bytes hold want's value, little endian, and
+  // nothing between params was written
+  bool Holds(const JrkConfigSnapshot& want) const {
+    bool covered[sizeof(bytes)] = {};
+    for(const auto& p : JrkConfigParams){
+      const unsigned id = static_cast<unsigned>(p.id);
+      const unsigned value = want.Get(p.id);
+      for(unsigned b = 0 ; b < p.bytes ; ++b){
+        if(bytes[id + b] != ((value >> (8 * b)) & 0xff)){
+          return false;
+        }
+        covered[id + b] = true;
+      }
+    }
+    for(size_t i = 0 ; i < sizeof(bytes) ; ++i){
+      if(!covered[i] && bytes[i]){
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Whether changing exactly the given params from base takes the expected
+// number of transfers and lands, and changing them back does too
+static bool Changes(Eeprom& dev, const JrkConfigSnapshot& base,
+                    std::initializer_list<JrkConfigParam> ids, unsigned expected) {
+  auto want = base;
+  for(auto id : ids){
+    want.Set(id, base.Get(id) ^ 1);
+  }
+  const bool applied = dev.Apply(want) == expected && dev.Holds(want);
+  const bool restored = dev.Apply(base) == expected && dev.Holds(base);
+  return applied && restored;
+}
+
+static JrkConfigSnapshot Randomize(JrkConfigSnapshot snap, size_t changes, std::mt19937& rng) {
+  std::vector<size_t> idx(JrkConfigParamCount);
+  for(size_t i = 0 ; i < idx.size() ; ++i){
+    idx[i] = i;
+  }
+  std::shuffle(idx.begin(), idx.end(), rng);
+  for(size_t i = 0 ; i < changes ; ++i){
+    const auto& p = JrkConfigParams[idx[i]];
+    const unsigned old = snap.Get(p.id);
+    const unsigned mask = (1u << (8 * p.bytes)) - 1;
+    snap.Set(p.id, (old + 1 + rng() % mask) & mask); // never the same value
+  }
+  return snap;
+}
+
+int main() {
+  std::mt19937 rng(1);
+  bool ok = true;
+  Eeprom dev;
+  const auto base = Randomize(JrkConfigSnapshot(), JrkConfigParamCount, rng);
+  std::vector<size_t> all(JrkConfigParamCount);
+  for(size_t i = 0 ; i < all.size() ; ++i){
+    all[i] = i;
+  }
+  for(const auto& t : JrkConfigGroup(all)){
+    dev.SetParameter(base.Pack(t), (t.bytes << 8u) | t.offset);
+  }
+  const unsigned fullwrite = dev.transfers;
+  ok &= dev.Holds(base);
+  dev.transfers = 0;
+  dev.Export();
+  std::cout << JrkConfigParamCount << " parameters: export takes " << dev.transfers
+            << " transfers, a full write " << fullwrite << std::endl;
+
+  // Each pair goes in one transfer, both its halves landing; neighbours
+  // which don't pair never share one
+  using P = JrkConfigParam;
+  ok &= Changes(dev, base, { P::PARAMETER_MOTOR_MAX_CURRENT_FORWARD,
+                             P::PARAMETER_MOTOR_MAX_CURRENT_REVERSE, }, 1);
+  ok &= Changes(dev, base, { P::PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD,
+                             P::PARAMETER_MOTOR_CURRENT_CALIBRATION_REVERSE, }, 1);
+  ok &= Changes(dev, base, { P::PARAMETER_MOTOR_MAX_CURRENT_REVERSE,
+                             P::PARAMETER_MOTOR_CURRENT_CALIBRATION_FORWARD, }, 2);
+  ok &= Changes(dev, base, { P::PARAMETER_MOTOR_BRAKE_DURATION_FORWARD,
+                             P::PARAMETER_MOTOR_BRAKE_DURATION_REVERSE, }, 2);
+  ok &= Changes(dev, base, { P::PARAMETER_MOTOR_MAX_CURRENT_REVERSE, }, 1);
+
+  std::cout << std::setw(8) << "changed" << std::setw(11) << "transfers"
+            << std::setw(12) << "saved-full" << std::setw(14) << "saved-single" << std::endl;
+  const size_t sizes[] = { 1, 2, 5, 10, 25, JrkConfigParamCount, };
+  for(auto changes : sizes){
+    uint64_t transfers = 0;
+    for(int i = 0 ; i < Trials ; ++i){
+      const auto want = Randomize(dev.Export(), changes, rng);
+      transfers += dev.Apply(want);
+      if(!dev.Holds(want) || !(dev.Export() == want)){
+        ok = false;
+      }
+    }
+    const double avg = static_cast<double>(transfers) / Trials;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(8) << changes << std::setw(11) << avg
+              << std::setw(12) << JrkConfigParamCount - avg
+              << std::setw(14) << changes - avg << std::endl;
+  }
+
+  std::ostringstream bin, text;
+  base.WriteBinary(bin);
+  base.WriteText(text);
+  JrkConfigSnapshot fromtext, frombin;
+  std::istringstream binin(bin.str()), textin(text.str());
+  frombin.ReadBinary(binin);
+  fromtext.ReadText(textin);
+  if(!(frombin == base) || !(fromtext == base)){
+    ok = false;
+  }
+  std::cout << "snapshot: " << bin.str().size() << " bytes binary, "
+            << text.str().size() << " bytes text" << std::endl;
+
+  if(!ok){
+    std::cerr << "applied configuration didn't match its snapshot" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if(!dev.valid){
+    std::cerr << "a transfer covered params the firmware wouldn't accept together" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <condition_variable>
+#include "poller.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Measures how quickly the Poller's current monitor stops the motor. With
+// the emulated jrk's motor running, a current is injected at a random phase
+// of the sampling period, and timed until the emulator processes the
+// resulting motor off. An overcurrent should typically be stopped within a
+// sample period, and always within a period plus a round trip; a current
+// over the rated current should trip I²t after window * (rated / current)²,
+// within two periods (one for detection, one for a sample skipped while
+// another was outstanding). I²t may trip early, since each sample is taken
+// to have held since the last: the one spanning the injection, or a stall
+// of the polling thread, overstates the heating. Run for both Poller
+// backends and several sample periods, both idle and loaded: with the jrk
+// serviced at 115200 baud and a caller keeping the read window full (and
+// more reads queued behind it), which the samples must not wait behind.
+// Exits nonzero if a stop is missed, or late.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: currentbench [ -n rounds ]\n";
+  os << " -n: injections per configuration and detector (default 20)\n";
+  os << std::endl;
+  exit(ret);
+}
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr JrkCurrentCalibration Calibration = { 149, 149, 0, 0, }; // as a jrk 12v12
+constexpr unsigned OvercurrentMa = 5000;
+constexpr unsigned RatedMa = 2000;
+constexpr auto Window = std::chrono::milliseconds(200);
+constexpr int OvercurrentRaw = 60; // 8.9A
+constexpr int SustainedRaw = 27; // 4.0A
+// Allowance for the round trip, timer granularity and scheduling jitter on
+// a loaded host, beyond the periods above. The I²t trip is further from
+// the injection, and has been seen up to 9ms late on a busy host, so it's
+// allowed more.
+constexpr auto Slack = std::chrono::milliseconds(5);
+constexpr auto I2tSlack = std::chrono::milliseconds(15);
+// The loaded runs
+constexpr auto ByteTime = std::chrono::microseconds(87); // 115200 baud
+constexpr size_t LoadWindow = 8;
+constexpr int LoadReads = 32; // outstanding at once, written or queued
+
+struct Result {
+  std::vector<double> overcurrent_ms;
+  std::vector<double> i2t_ms;
+  unsigned missed;
+};
+
+// Injects raw current, and returns the time until the emulator stopped, or
+// a negative value if it didn't within a second.
+static double Inject(JrkEmulator& emu, Poller& p, int raw, std::mt19937& rng,
+                     std::chrono::microseconds period) {
+  p.SetJrkTarget(2048); // motor on, holding position; the model draws nothing
+  std::uniform_int_distribution<long> phase(0, period.count());
+  std::this_thread::sleep_for(period * 2 + std::chrono::microseconds(phase(rng)));
+  p.ResetCurrentMonitor();
+  const auto stops = emu.Stops();
+  const auto start = clock_type::now();
+  emu.InjectCurrent(raw);
+  while(emu.Stops() == stops && clock_type::now() - start < std::chrono::seconds(1)){
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+  emu.InjectCurrent(-1);
+  if(emu.Stops() == stops){
+    return -1;
+  }
+  return std::chrono::duration<double, std::milli>(emu.LastStop() - start).count();
+}
+
+// Keeps LoadReads reads of Feedback outstanding until stopped
+struct Load {
+  std::mutex lock;
+  std::condition_variable cv;
+  int outstanding = 0;
+  bool stop = false;
+
+  void Run(Poller& p) {
+    auto done = [this](const JrkVariable&, int, int){
+      std::lock_guard<std::mutex> guard(lock);
+      --outstanding;
+      cv.notify_one();
+    };
+    std::unique_lock<std::mutex> lk(lock);
+    while(true){
+      cv.wait(lk, [this]{ return stop || outstanding < LoadReads; });
+      if(stop){
+        break;
+      }
+      ++outstanding;
+      lk.unlock();
+      p.ReadJrk(JrkVar::Feedback, done);
+      lk.lock();
+    }
+    cv.wait(lk, [this]{ return outstanding == 0; });
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+    cv.notify_one();
+  }
+};
+
+static Result Bench(PollerBackend backend, std::chrono::microseconds period, int rounds,
+                    bool loaded) {
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency, backend);
+  CurrentMonitorConfig cfg;
+  cfg.overcurrent_ma = OvercurrentMa;
+  cfg.rated_ma = RatedMa;
+  cfg.window = Window;
+  p.SetCurrentMonitor(Calibration, cfg, period);
+  Load load;
+  if(loaded){
+    emu.SetServiceTime(ByteTime);
+    p.SetReadWindow(LoadWindow);
+  }
+  std::thread usb(&Poller::Poll, std::ref(p));
+  std::thread reader;
+  if(loaded){
+    reader = std::thread(&Load::Run, &load, std::ref(p));
+  }
+  std::mt19937 rng(1);
+  Result r{ {}, {}, 0, };
+  for(int i = 0 ; i < rounds ; ++i){
+    const double oc = Inject(emu, p, OvercurrentRaw, rng, period);
+    if(oc < 0){
+      ++r.missed;
+    }else{
+      r.overcurrent_ms.push_back(oc);
+    }
+    const double i2t = Inject(emu, p, SustainedRaw, rng, period);
+    if(i2t < 0){
+      ++r.missed;
+    }else{
+      r.i2t_ms.push_back(i2t);
+    }
+  }
+  if(loaded){
+    load.Stop();
+    reader.join();
+  }
+  p.StopPolling();
+  usb.join();
+  if(p.Stats().current_trips != r.overcurrent_ms.size() + r.i2t_ms.size()){
+    ++r.missed; // a stop came from somewhere other than the monitor
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  int rounds = 20;
+  int opt;
+  while((opt = getopt(argc, argv, "n:")) != -1){
+    switch(opt){
+      case 'n': rounds = atoi(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || rounds <= 0){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  const struct {
+    const char* name;
+    PollerBackend backend;
+  } backends[] = {
+    { "poll", PollerBackend::Poll, },
+    { "io_uring", PollerBackend::IoUring, },
+  };
+  const std::chrono::milliseconds periods[] = {
+    std::chrono::milliseconds(1), std::chrono::milliseconds(2),
+    std::chrono::milliseconds(5), std::chrono::milliseconds(10),
+  };
+  const double amps = Calibration.Milliamps(SustainedRaw, 0) / 1000.0;
+  const double expected = std::chrono::duration<double, std::milli>(Window).count() *
+                          std::pow(RatedMa / 1000.0 / amps, 2);
+  std::cout << "overcurrent: " << Calibration.Milliamps(OvercurrentRaw, 0) << "mA against "
+            << OvercurrentMa << "mA; I2t: " << Calibration.Milliamps(SustainedRaw, 0)
+            << "mA against " << RatedMa << "mA over " << Window.count() << "ms, expect "
+            << std::fixed << std::setprecision(1) << expected << "ms" << std::endl;
+  std::cout << std::setw(9) << "backend" << std::setw(7) << "load" << std::setw(8) << "period"
+            << std::setw(10) << "oc-p50" << std::setw(10) << "oc-worst"
+            << std::setw(10) << "i2t-min" << std::setw(10) << "i2t-max"
+            << std::setw(8) << "missed" << std::endl;
+  bool ok = true;
+  for(const auto& b : backends){
+    for(bool loaded : { false, true, }){
+      for(auto period : periods){
+        Result r;
+        try{
+          r = Bench(b.backend, period, rounds, loaded);
+        }catch(std::runtime_error& e){
+          std::cerr << b.name << ": " << e.what() << std::endl;
+          return EXIT_FAILURE;
+        }
+        auto& oc = r.overcurrent_ms;
+        auto& i2t = r.i2t_ms;
+        std::sort(oc.begin(), oc.end());
+        std::sort(i2t.begin(), i2t.end());
+        const double periodms = std::chrono::duration<double, std::milli>(period).count();
+        const double slackms = std::chrono::duration<double, std::milli>(Slack).count();
+        const double i2tslackms = std::chrono::duration<double, std::milli>(I2tSlack).count();
+        std::cout << std::setw(9) << b.name << std::setw(7) << (loaded ? "yes" : "no")
+                  << std::setw(6) << period.count() << "ms"
+                  << std::setw(10) << (oc.empty() ? NAN : oc[oc.size() / 2])
+                  << std::setw(10) << (oc.empty() ? NAN : oc.back())
+                  << std::setw(10) << (i2t.empty() ? NAN : i2t.front())
+                  << std::setw(10) << (i2t.empty() ? NAN : i2t.back())
+                  << std::setw(8) << r.missed << std::endl;
+        ok &= r.missed == 0 && !oc.empty() && oc[oc.size() / 2] <= periodms &&
+              oc.back() <= periodms + slackms;
+        ok &= !i2t.empty() && i2t.back() <= expected + 2 * periodms + i2tslackms;
+      }
+    }
+  }
+  if(!ok){
+    std::cerr << "the current monitor missed a stop, or stopped late" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <queue>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include "protocol.h"
+
+using namespace PololuJrkUSB;
+
+// Decode throughput of the descriptor-table JrkDecoder, compared against the
+// opcode switch it replaced. No I/O is performed; replies are synthesized.
+
+constexpr auto Replies = 1u << 22;
+
+// The old HandleUSB() decoder, minus printing. Every reply is two bytes.
+static long LegacyDecode(std::queue<unsigned char>& sent,
+                         const unsigned char* buf, size_t len) {
+  long sum = 0;
+  for(size_t off = 0 ; off + 2 <= len ; off += 2){
+    unsigned uword = buf[off + 1] * 256 + buf[off];
+    if(sent.empty()){
+      continue;
+    }
+    unsigned char expcmd = sent.front();
+    sent.pop();
+    int16_t sig;
+    uint16_t unsig = uword;
+    switch(expcmd){
+      case 0xa1: sum += uword; break;
+      case 0xa3: sum += uword; break;
+      case 0xa5: sum += uword; break;
+      case 0xa7: sum += uword; break;
+      case 0xa9: memcpy(&sig, &unsig, sizeof(sig)); sum += sig; break;
+      case 0xab: memcpy(&sig, &unsig, sizeof(sig)); sum += sig; break;
+      case 0xad: memcpy(&sig, &unsig, sizeof(sig)); sum += sig; break;
+      case 0xb1: sum += uword; break;
+      case 0xb5: sum += uword; break;
+      default: break;
+    }
+  }
+  return sum;
+}
+
+int main(void){
+  // The legacy decoder can't handle 1-byte replies, so leave Current out
+  // of the mix for a fair comparison.
+  std::vector<JrkVar> mix;
+  for(const auto& v : JrkVariables){
+    if(v.width == 2){
+      mix.push_back(v.id);
+    }
+  }
+  std::mt19937 rng(0);
+  std::vector<JrkVar> cmds(Replies);
+  std::vector<unsigned char> wire;
+  for(auto& c : cmds){
+    c = mix[rng() % mix.size()];
+    wire.push_back(rng());
+    wire.push_back(rng());
+  }
+
+  std::queue<unsigned char> legacy;
+  for(auto c : cmds){
+    legacy.push(JrkDescribe(c).opcode);
+  }
+  auto start = std::chrono::steady_clock::now();
+  volatile long lsum = LegacyDecode(legacy, wire.data(), wire.size());
+  auto lns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start).count();
+
+  JrkDecoder decoder;
+  for(auto c : cmds){
+    decoder.Sent(c);
+  }
+  long tsum = 0;
+  start = std::chrono::steady_clock::now();
+  decoder.Feed(wire.data(), wire.size(),
+    [&tsum](const JrkVariable&, int val){ tsum += val; });
+  auto tns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start).count();
+  volatile long vtsum = tsum;
+
+  if(lsum != vtsum){
+    std::cerr << "decoders disagree: " << lsum << " != " << vtsum << std::endl;
+    return 1;
+  }
+  std::cout << "replies: " << Replies << std::endl;
+  std::cout << "switch: " << static_cast<double>(lns) / Replies << " ns/reply ("
+            << Replies * 1000.0 / lns << " Mreplies/s)" << std::endl;
+  std::cout << "table:  " << static_cast<double>(tns) / Replies << " ns/reply ("
+            << Replies * 1000.0 / tns << " Mreplies/s)" << std::endl;
+  return 0;
+}
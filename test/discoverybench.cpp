@@ -0,0 +1,90 @@
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include <algorithm>
+#include <libusb.h>
+#include "discovery.h"
+
+using namespace PololuJrkUSB;
+
+// Measures the time to ready of DiscoverJrks() against whatever jrks are
+// attached (e.g. a rig of 16 controllers): once cold, with an empty cache,
+// then repeatedly warm. Exits nonzero if any device fails to probe, or a
+// warm run doesn't validate every device with a serial number from the
+// cache.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: discoverybench [ -n runs ]\n";
+  os << " -n: warm runs (default 20)\n";
+  os << std::endl;
+  exit(ret);
+}
+
+static double Ms(std::chrono::nanoseconds ns) {
+  return std::chrono::duration<double, std::milli>(ns).count();
+}
+
+int main(int argc, char** argv) {
+  int runs = 20;
+  int opt;
+  while((opt = getopt(argc, argv, "n:")) != -1){
+    switch(opt){
+      case 'n': runs = atoi(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || runs <= 0){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  libusb_context* ctx;
+  if(int e = libusb_init(&ctx)){
+    std::cerr << "error initializing libusb: "
+              << libusb_strerror(static_cast<libusb_error>(e)) << std::endl;
+    return EXIT_FAILURE;
+  }
+  char cachepath[] = "/tmp/discoverybench.XXXXXX";
+  int fd = mkstemp(cachepath);
+  if(fd < 0){
+    std::cerr << "couldn't create cache file" << std::endl;
+    libusb_exit(ctx);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  bool ok = true;
+  try{
+    auto cold = DiscoverJrks(ctx, cachepath);
+    const auto devices = cold.devices.size();
+    // only devices with serial numbers can be cached
+    const auto cacheable = std::count_if(cold.devices.begin(), cold.devices.end(),
+                                         [](const JrkDeviceInfo& i){ return !i.serial.empty(); });
+    ok &= cold.errors.empty();
+    std::vector<double> warm;
+    for(int i = 0 ; i < runs ; ++i){
+      auto r = DiscoverJrks(ctx, cachepath);
+      ok &= r.errors.empty() && r.devices.size() == devices && r.warm == cacheable;
+      warm.push_back(Ms(r.elapsed));
+    }
+    std::sort(warm.begin(), warm.end());
+    std::cout << std::fixed << std::setprecision(2) << devices << " jrk(s): cold "
+              << Ms(cold.elapsed) << "ms, warm p50 " << warm[warm.size() / 2]
+              << "ms max " << warm.back() << "ms" << std::endl;
+    for(const auto& err : cold.errors){
+      std::cerr << "error probing jrk: " << err << std::endl;
+    }
+  }catch(std::runtime_error& e){
+    std::cerr << e.what() << std::endl;
+    ok = false;
+  }
+  unlink(cachepath);
+  libusb_exit(ctx);
+  if(!ok){
+    std::cerr << "a jrk failed to probe, or wasn't validated from the cache" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
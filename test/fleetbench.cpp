@@ -0,0 +1,311 @@
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <condition_variable>
+#include "poller.h"
+#include "shard.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Drives a fleet of N emulated jrks, each behind its own pty and Poller, for
+// N = 1, 2, 4... up to a maximum. Each device keeps a window of commands
+// outstanding, a configurable fraction of which are reads (the rest set the
+// target). For each N, reports aggregate throughput, per-device read
+// latency, CPU (of the whole process, emulators included) and resident
+// memory. With -S, the fleet is polled by a ShardedPoller with the given
+// number of shards (0 for one per CPU), rather than a thread per device.
+// Exits nonzero if any read fails.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: fleetbench [ -n maxdevices ] [ -s seconds ] [ -r readpct ] [ -w window ] [ -S shards ]\n";
+  os << " -n: largest fleet to run (default 512)\n";
+  os << " -s: seconds to drive each fleet (default 2)\n";
+  os << " -r: percentage of commands which are reads (default 90)\n";
+  os << " -w: commands kept outstanding per device (default 4)\n";
+  os << " -S: poll with this many shards (0: one per CPU)\n";
+  os << std::endl;
+  exit(ret);
+}
+
+using clock_type = std::chrono::steady_clock;
+
+// Wakes the driver thread owning a device when one of its reads completes
+struct Driver {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool kicked = false;
+
+  void Kick() {
+    std::lock_guard<std::mutex> guard(lock);
+    kicked = true;
+    cv.notify_one();
+  }
+};
+
+struct Device {
+  std::unique_ptr<JrkEmulator> emu;
+  std::unique_ptr<Poller> poller; // null if sharded
+  std::thread poll;
+  ShardedPoller* sharded;
+  ShardDeviceId id;
+  Driver* driver;
+  std::atomic<int> outstanding{0};
+  uint64_t commands = 0; // driver thread only
+  // written only from the thread polling this device
+  std::vector<uint32_t> latencies; // nanoseconds
+  uint64_t failed = 0;
+};
+
+struct Step {
+  double replies_sec;
+  double commands_sec;
+  double p50_us;        // over all reads
+  double p99_median_us; // the median device's 99th percentile
+  double p99_worst_us;  // the worst device's 99th percentile
+  double cpu_cores;
+  double rss_mb;
+  double kb_per_device;
+  uint64_t failed;
+  uint64_t migrations;
+};
+
+static double CPUSeconds() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double RSSBytes() {
+  std::ifstream statm("/proc/self/statm");
+  long size, resident;
+  if(!(statm >> size >> resident)){
+    return 0;
+  }
+  return static_cast<double>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Each pty costs the emulator three descriptors and the Poller two
+static void RaiseFileLimit() {
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max){
+    rl.rlim_cur = rl.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE, &rl)){
+      std::cerr << "warning: couldn't raise RLIMIT_NOFILE" << std::endl;
+    }
+  }
+}
+
+static uint32_t Percentile(std::vector<uint32_t>& v, double p) {
+  if(v.empty()){
+    return 0;
+  }
+  auto nth = v.begin() + static_cast<size_t>(p * (v.size() - 1));
+  std::nth_element(v.begin(), nth, v.end());
+  return *nth;
+}
+
+static void Drive(std::vector<Device*> devs, Driver& drv, int window,
+                  int readpct, const std::atomic<bool>& stop) {
+  unsigned seed = devs.size();
+  while(!stop.load(std::memory_order_relaxed)){
+    for(auto d : devs){
+      while(d->outstanding.load(std::memory_order_acquire) < window){
+        ++d->commands;
+        if(static_cast<int>(rand_r(&seed) % 100) >= readpct){
+          const int target = rand_r(&seed) % (JrkTargetMax + 1);
+          if(d->sharded){
+            d->sharded->SetJrkTarget(d->id, target);
+          }else{
+            d->poller->SetJrkTarget(target);
+          }
+          continue;
+        }
+        d->outstanding.fetch_add(1, std::memory_order_acq_rel);
+        const auto sent = clock_type::now();
+        PollerCompletion done = [d, sent](const JrkVariable&, int, int err){
+          if(err){
+            ++d->failed;
+          }else{
+            d->latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     clock_type::now() - sent).count());
+          }
+          d->outstanding.fetch_sub(1, std::memory_order_acq_rel);
+          d->driver->Kick();
+        };
+        if(d->sharded){
+          d->sharded->ReadJrk(d->id, JrkVar::Feedback, std::move(done));
+        }else{
+          d->poller->ReadJrk(JrkVar::Feedback, std::move(done));
+        }
+      }
+    }
+    std::unique_lock<std::mutex> lk(drv.lock);
+    drv.cv.wait_for(lk, std::chrono::milliseconds(10), [&drv]{ return drv.kicked; });
+    drv.kicked = false;
+  }
+}
+
+static Step RunFleet(unsigned n, std::chrono::milliseconds duration,
+                     int window, int readpct, int shards) {
+  const double rss0 = RSSBytes();
+  std::unique_ptr<ShardedPoller> sharded;
+  if(shards >= 0){
+    ShardConfig cfg;
+    cfg.shards = shards;
+    sharded = std::make_unique<ShardedPoller>(cfg);
+  }
+  std::vector<std::unique_ptr<Device>> devs;
+  const unsigned drivercount = std::min<unsigned>(n, std::max(1u, std::thread::hardware_concurrency() / 2));
+  std::vector<Driver> drivers(drivercount);
+  for(unsigned i = 0 ; i < n ; ++i){
+    auto d = std::make_unique<Device>();
+    d->emu = std::make_unique<JrkEmulator>();
+    d->sharded = sharded.get();
+    if(sharded){
+      d->id = sharded->AddDevice(d->emu->Path().c_str());
+    }else{
+      d->poller = std::make_unique<Poller>(d->emu->Path().c_str(), nullptr,
+                                           PollerTransport::LowLatency);
+    }
+    d->driver = &drivers[i % drivercount];
+    devs.emplace_back(std::move(d));
+  }
+  for(auto& d : devs){
+    if(d->poller){
+      d->poll = std::thread(&Poller::Poll, d->poller.get());
+    }
+  }
+
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  const double cpu = CPUSeconds();
+  const auto start = clock_type::now();
+  for(unsigned i = 0 ; i < drivercount ; ++i){
+    std::vector<Device*> mine;
+    for(unsigned j = i ; j < n ; j += drivercount){
+      mine.push_back(devs[j].get());
+    }
+    threads.emplace_back(Drive, std::move(mine), std::ref(drivers[i]),
+                         window, readpct, std::cref(stop));
+  }
+  std::this_thread::sleep_for(duration);
+  stop = true;
+  for(auto& t : threads){
+    t.join();
+  }
+  const double secs = std::chrono::duration<double>(clock_type::now() - start).count();
+  const double cpusecs = CPUSeconds() - cpu;
+  const double rss = RSSBytes();
+  // let stragglers complete before reading their latencies
+  const auto drainuntil = clock_type::now() + std::chrono::seconds(1);
+  for(auto& d : devs){
+    while(d->outstanding.load() && clock_type::now() < drainuntil){
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  Step s{};
+  if(sharded){
+    for(const auto& st : sharded->Stats()){
+      s.migrations += st.migrations;
+    }
+    sharded.reset();
+  }
+  for(auto& d : devs){
+    if(d->poller){
+      d->poller->StopPolling();
+      d->poll.join();
+    }
+  }
+
+  uint64_t replies = 0, commands = 0;
+  std::vector<uint32_t> all, p99s;
+  for(auto& d : devs){
+    replies += d->latencies.size();
+    commands += d->commands;
+    s.failed += d->failed;
+    all.insert(all.end(), d->latencies.begin(), d->latencies.end());
+    p99s.push_back(Percentile(d->latencies, 0.99));
+  }
+  s.replies_sec = replies / secs;
+  s.commands_sec = commands / secs;
+  s.p50_us = Percentile(all, 0.5) / 1e3;
+  s.p99_median_us = Percentile(p99s, 0.5) / 1e3;
+  s.p99_worst_us = Percentile(p99s, 1.0) / 1e3;
+  s.cpu_cores = cpusecs / secs;
+  s.rss_mb = rss / (1 << 20);
+  s.kb_per_device = (rss - rss0) / 1024 / n;
+  return s;
+}
+
+int main(int argc, char** argv) {
+  unsigned maxdevs = 512;
+  double seconds = 2;
+  int readpct = 90;
+  int window = 4;
+  int shards = -1;
+  int opt;
+  while((opt = getopt(argc, argv, "n:s:r:w:S:")) != -1){
+    switch(opt){
+      case 'n': maxdevs = atoi(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      case 'r': readpct = atoi(optarg); break;
+      case 'w': window = atoi(optarg); break;
+      case 'S': shards = atoi(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || maxdevs < 1 || seconds <= 0 || readpct < 1 ||
+     readpct > 100 || window < 1){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  RaiseFileLimit();
+  const auto duration = std::chrono::milliseconds(static_cast<long>(seconds * 1000));
+
+  std::cout << std::setw(5) << "N" << std::setw(11) << "replies/s"
+            << std::setw(11) << "cmds/s" << std::setw(9) << "p50us"
+            << std::setw(11) << "p99us-med" << std::setw(11) << "p99us-max"
+            << std::setw(7) << "cores" << std::setw(9) << "RSS-MB"
+            << std::setw(10) << "KB/dev" << (shards >= 0 ? "  moves" : "") << std::endl;
+  uint64_t failed = 0;
+  for(unsigned n = 1 ; ; n = std::min(n * 2, maxdevs)){
+    Step s;
+    try{
+      s = RunFleet(n, duration, window, readpct, shards);
+    }catch(std::runtime_error& e){
+      std::cerr << "couldn't build a fleet of " << n << ": " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    failed += s.failed;
+    std::cout << std::fixed << std::setprecision(1)
+              << std::setw(5) << n << std::setw(11) << s.replies_sec
+              << std::setw(11) << s.commands_sec << std::setw(9) << s.p50_us
+              << std::setw(11) << s.p99_median_us << std::setw(11) << s.p99_worst_us
+              << std::setw(7) << std::setprecision(2) << s.cpu_cores
+              << std::setw(9) << std::setprecision(1) << s.rss_mb
+              << std::setw(10) << s.kb_per_device;
+    if(shards >= 0){
+      std::cout << std::setw(7) << s.migrations;
+    }
+    std::cout << std::endl;
+    if(n == maxdevs){
+      break;
+    }
+  }
+  if(failed){
+    std::cerr << failed << " reads failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include "poller.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Exercises the Poller's heartbeat against an emulated jrk enforcing a
+// serial timeout. An idle link should be kept alive with keepalives alone; a
+// busy link should need none; and a stalled Poll() thread should be reported
+// as a missed deadline (and seen by the jrk as a timeout). Reports the
+// keepalives and bytes sent per second in each case, and exits nonzero if
+// the jrk times out when it shouldn't, or a stall goes unreported.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: heartbeatbench [ -t timeout-ms ] [ -s seconds ]\n";
+  os << " -t: the jrk's serial timeout (default 50ms)\n";
+  os << " -s: seconds to run each case (default 2)\n";
+  os << std::endl;
+  exit(ret);
+}
+
+enum class Load {
+  Idle,    // nothing but the heartbeat
+  Busy,    // a read every tenth of the timeout
+  Stalled, // idle, but the Poll() thread blocks once for three timeouts
+};
+
+struct Result {
+  double keepalives_sec;
+  double bytes_sec; // written to the jrk
+  uint64_t missed;  // reported by the Poller
+  uint64_t lapses;  // serial timeouts seen by the jrk
+};
+
+static Result Run(Load load, std::chrono::milliseconds timeout,
+                  std::chrono::milliseconds duration) {
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency);
+  std::atomic<uint64_t> missed(0);
+  p.SetHeartbeat(timeout, [&missed](std::chrono::nanoseconds){ ++missed; });
+  emu.SetSerialTimeout(timeout);
+  bool stalled = load != Load::Stalled;
+  p.SetReplyCallback([&stalled, timeout](const JrkVariable&, int){
+    if(!stalled){
+      stalled = true;
+      std::this_thread::sleep_for(timeout * 3);
+    }
+  });
+  std::thread usb(&Poller::Poll, std::ref(p));
+  if(load == Load::Stalled){
+    p.ReadJrk(JrkVar::Target); // its reply stalls the Poll() thread
+  }
+  const auto start = std::chrono::steady_clock::now();
+  while(std::chrono::steady_clock::now() - start < duration){
+    if(load == Load::Busy){
+      p.ReadJrk(JrkVar::Feedback);
+      std::this_thread::sleep_for(timeout / 10);
+    }else{
+      std::this_thread::sleep_for(timeout);
+    }
+  }
+  const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  // one last command, so the jrk notices any lapse at the end
+  p.ReadJrk(JrkVar::Target);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  p.StopPolling();
+  usb.join();
+  const auto st = p.Stats();
+  return Result{ st.heartbeats / secs, st.bytes_out / secs, missed, emu.SerialTimeouts(), };
+}
+
+int main(int argc, char** argv) {
+  int timeoutms = 50;
+  double seconds = 2;
+  int opt;
+  while((opt = getopt(argc, argv, "t:s:")) != -1){
+    switch(opt){
+      case 't': timeoutms = atoi(optarg); break;
+      case 's': seconds = atof(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || timeoutms < 10 || seconds <= 0){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  const auto timeout = std::chrono::milliseconds(timeoutms);
+  const auto duration = std::chrono::milliseconds(static_cast<long>(seconds * 1000));
+  const struct {
+    const char* name;
+    Load load;
+  } cases[] = {
+    { "idle", Load::Idle, },
+    { "busy", Load::Busy, },
+    { "stalled", Load::Stalled, },
+  };
+  std::cout << std::setw(8) << "load" << std::setw(14) << "keepalives/s"
+            << std::setw(10) << "bytes/s" << std::setw(8) << "missed"
+            << std::setw(8) << "lapses" << std::endl;
+  bool ok = true;
+  for(const auto& c : cases){
+    Result r;
+    try{
+      r = Run(c.load, timeout, duration);
+    }catch(std::runtime_error& e){
+      std::cerr << c.name << ": " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << std::setw(8) << c.name << std::fixed << std::setprecision(1)
+              << std::setw(14) << r.keepalives_sec << std::setw(10) << r.bytes_sec
+              << std::setw(8) << r.missed << std::setw(8) << r.lapses << std::endl;
+    if(c.load == Load::Stalled){
+      ok &= r.missed > 0;
+    }else{
+      ok &= r.lapses == 0 && r.missed == 0;
+    }
+  }
+  if(!ok){
+    std::cerr << "heartbeat failed to keep the link alive, or to report a stall" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
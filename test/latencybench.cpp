@@ -0,0 +1,99 @@
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include "poller.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Measures round-trip latency and syscall overhead of each transport
+// profile, against the device named on the command line, or an emulated
+// jrk on a pty if none is given.
+
+constexpr int RoundTrips = 2000;
+constexpr int Bursts = 200;
+constexpr int BurstSize = 16;
+
+struct Waiter {
+  std::mutex lock;
+  std::condition_variable cv;
+  int remaining = 0;
+
+  void Arm(int n) {
+    std::lock_guard<std::mutex> guard(lock);
+    remaining = n;
+  }
+
+  void Done() {
+    std::lock_guard<std::mutex> guard(lock);
+    if(--remaining == 0){
+      cv.notify_one();
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lk(lock);
+    cv.wait(lk, [this]{ return remaining == 0; });
+  }
+};
+
+static void Bench(const char* dev, const char* name, PollerTransport transport) {
+  Poller p(dev, nullptr, transport);
+  Waiter w;
+  auto done = [&w](const JrkVariable&, int, int){ w.Done(); };
+  std::thread usb(&Poller::Poll, std::ref(p));
+
+  std::vector<double> rtts;
+  for(int i = 0 ; i < RoundTrips ; ++i){
+    w.Arm(1);
+    auto start = std::chrono::steady_clock::now();
+    p.ReadJrk(JrkVar::Feedback, done);
+    w.Wait();
+    rtts.push_back(std::chrono::duration<double, std::micro>(
+                   std::chrono::steady_clock::now() - start).count());
+  }
+  auto single = p.Stats();
+  for(int i = 0 ; i < Bursts ; ++i){
+    w.Arm(BurstSize);
+    for(int j = 0 ; j < BurstSize ; ++j){
+      p.ReadJrk(JrkVar::Feedback, done);
+    }
+    w.Wait();
+  }
+  auto total = p.Stats();
+  p.StopPolling();
+  usb.join();
+
+  std::sort(rtts.begin(), rtts.end());
+  const double breplies = total.replies - single.replies;
+  std::cout << std::fixed << std::setprecision(2) << name
+            << (p.DriverLowLatency() ? " (driver low latency)" : "") << "\n"
+            << "  round trip us: p50 " << rtts[rtts.size() / 2]
+            << " p99 " << rtts[rtts.size() * 99 / 100]
+            << " max " << rtts.back() << "\n"
+            << "  lockstep: " << static_cast<double>(single.wakeups) / single.replies
+            << " wakeups/reply, " << static_cast<double>(single.reads) / single.replies
+            << " reads/reply\n"
+            << "  bursts of " << BurstSize << ": "
+            << (total.wakeups - single.wakeups) / breplies << " wakeups/reply, "
+            << (total.reads - single.reads) / breplies << " reads/reply" << std::endl;
+}
+
+int main(int argc, const char** argv){
+  std::unique_ptr<JrkEmulator> emu;
+  const char* dev;
+  if(argc > 1){
+    dev = argv[1];
+  }else{
+    emu = std::make_unique<JrkEmulator>();
+    dev = emu->Path().c_str();
+  }
+  Bench(dev, "default", PollerTransport::Default);
+  Bench(dev, "lowlatency", PollerTransport::LowLatency);
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <atomic>
+#include <thread>
+#include <iostream>
+#include "poller.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Loses reply bytes on an emulated jrk every few rounds, and checks that
+// the Poller notices, resynchronizes, and never delivers a reply to the
+// wrong command, whether before the loss is detected or after recovery;
+// and that no read reaches the jrk more often than it was issued and
+// reissued. Reports resynchronization recovery time, for both backends.
+
+constexpr int Rounds = 40;
+constexpr int LossEvery = 4; // drop a reply byte every this many rounds
+constexpr int Burst = 8; // reads per round
+
+static bool Run(const char* name, PollerBackend backend){
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::Default, backend);
+  p.SetReplyTimeout(std::chrono::milliseconds(50));
+  std::thread usb(&Poller::Poll, std::ref(p));
+
+  int lossmismatches = 0, cleanmismatches = 0, errors = 0;
+  for(int round = 0 ; round < Rounds ; ++round){
+    const bool lossy = round % LossEvery == LossEvery - 1;
+    const int target = 1000 + round * 37;
+    p.SetJrkTarget(target);
+    if(lossy){
+      emu.DropReplyBytes(1);
+    }
+    std::atomic<int> done(0), mismatches(0), failed(0);
+    auto check = [&](const JrkVariable&, int value, int err){
+      if(err){
+        ++failed;
+      }else if(value != target){
+        ++mismatches;
+      }
+      ++done;
+    };
+    for(int i = 0 ; i < Burst ; ++i){
+      p.ReadJrk(JrkVar::Target, check);
+    }
+    while(done < Burst){
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    (lossy ? lossmismatches : cleanmismatches) += mismatches;
+    errors += failed;
+  }
+  p.StopPolling();
+  usb.join();
+
+  auto s = p.Stats();
+  // set targets, reads, reissues and probes, plus a rewritten set target
+  // per resync at most
+  const uint64_t sent = Rounds * 2 + Rounds * Burst + s.reissued + s.resyncs * 3;
+  std::cout << name << ": rounds: " << Rounds << " (" << Rounds / LossEvery
+            << " lossy) reads: " << Rounds * Burst << std::endl;
+  std::cout << " timeouts: " << s.timeouts << " resyncs: " << s.resyncs
+            << " recoveries: " << s.recoveries << " reissued: " << s.reissued
+            << " failed: " << s.failed << " dropped: " << s.dropped << std::endl;
+  std::cout << " misattributed before detection: " << lossmismatches
+            << ", after recovery: " << cleanmismatches << std::endl;
+  std::cout << " bytes received by the jrk: " << emu.BytesReceived()
+            << " (at most " << sent << " expected)" << std::endl;
+  std::cout << " recovery last: " << s.recovery_last.count() / 1000 << "us max: "
+            << s.recovery_max.count() / 1000 << "us" << std::endl;
+  return !lossmismatches && !cleanmismatches && emu.BytesReceived() <= sent;
+}
+
+int main(void){
+  bool ok = Run("poll", PollerBackend::Poll);
+  ok &= Run("io_uring", PollerBackend::IoUring);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <condition_variable>
+#include "poller.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Measures how long a motor off waits behind a burst of reads. The emulated
+// jrk is slowed to a fixed service time per command byte, so that reads back
+// up in the pty as they would behind a real UART. Each round pipelines a
+// burst of reads, then calls SetJrkOff(), and times until the emulator
+// processes the off. Run for both Poller backends and several read windows;
+// reports the median and worst stop latency.
+
+static void
+usage(std::ostream& os, int ret) {
+  os << "usage: stopbench [ -b burst ] [ -n rounds ] [ -t service-us ]\n";
+  os << " -b: reads outstanding when the stop is issued (default 300)\n";
+  os << " -n: rounds per configuration (default 20)\n";
+  os << " -t: emulated service time per command byte (default 100us)\n";
+  os << std::endl;
+  exit(ret);
+}
+
+using clock_type = std::chrono::steady_clock;
+
+struct Result {
+  double p50_us;
+  double worst_us;
+  unsigned failed;
+};
+
+static Result Bench(PollerBackend backend, size_t window, int burst, int rounds,
+                    std::chrono::microseconds service) {
+  JrkEmulator emu;
+  emu.SetServiceTime(service);
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency, backend);
+  p.SetReadWindow(window);
+  p.SetReplyTimeout(std::chrono::seconds(5));
+  std::mutex lock;
+  std::condition_variable cv;
+  int outstanding = 0;
+  unsigned failed = 0;
+  auto done = [&](const JrkVariable&, int, int err){
+    std::lock_guard<std::mutex> guard(lock);
+    --outstanding;
+    failed += !!err;
+    cv.notify_one();
+  };
+  std::thread usb(&Poller::Poll, std::ref(p));
+  std::vector<double> latencies;
+  for(int r = 0 ; r < rounds ; ++r){
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      outstanding = burst;
+    }
+    for(int i = 0 ; i < burst ; ++i){
+      p.ReadJrk(JrkVar::Feedback, done);
+    }
+    // let the burst reach the device before stopping
+    std::this_thread::sleep_for(service * 4);
+    const auto stops = emu.Stops();
+    const auto sent = clock_type::now();
+    p.SetJrkOff();
+    while(emu.Stops() == stops){
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(emu.LastStop() - sent).count());
+    std::unique_lock<std::mutex> lk(lock);
+    cv.wait(lk, [&]{ return outstanding == 0; });
+  }
+  p.StopPolling();
+  usb.join();
+  std::sort(latencies.begin(), latencies.end());
+  return Result{ latencies[latencies.size() / 2], latencies.back(), failed, };
+}
+
+int main(int argc, char** argv) {
+  int burst = 300;
+  int rounds = 20;
+  int serviceus = 100;
+  int opt;
+  while((opt = getopt(argc, argv, "b:n:t:")) != -1){
+    switch(opt){
+      case 'b': burst = atoi(optarg); break;
+      case 'n': rounds = atoi(optarg); break;
+      case 't': serviceus = atoi(optarg); break;
+      default: usage(std::cerr, EXIT_FAILURE);
+    }
+  }
+  if(argc != optind || burst < 1 || rounds < 1 || serviceus < 1){
+    usage(std::cerr, EXIT_FAILURE);
+  }
+  const struct {
+    const char* name;
+    PollerBackend backend;
+  } backends[] = {
+    { "poll", PollerBackend::Poll, },
+    { "io_uring", PollerBackend::IoUring, },
+  };
+  const size_t windows[] = { 0, 16, 4, };
+  std::cout << std::setw(9) << "backend" << std::setw(8) << "window"
+            << std::setw(11) << "p50us" << std::setw(11) << "worstus" << std::endl;
+  unsigned failed = 0;
+  for(const auto& b : backends){
+    for(auto w : windows){
+      Result r;
+      try{
+        r = Bench(b.backend, w, burst, rounds, std::chrono::microseconds(serviceus));
+      }catch(std::runtime_error& e){
+        std::cerr << b.name << ": " << e.what() << std::endl;
+        break;
+      }
+      failed += r.failed;
+      std::cout << std::setw(9) << b.name << std::setw(8)
+                << (w ? std::to_string(w) : "none")
+                << std::fixed << std::setprecision(1)
+                << std::setw(11) << r.p50_us << std::setw(11) << r.worst_us << std::endl;
+    }
+  }
+  if(failed){
+    std::cerr << failed << " reads failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
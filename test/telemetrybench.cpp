@@ -0,0 +1,113 @@
+#include <cmath>
+#include <thread>
+#include <random>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include "telemetry.h"
+#include "emulator.h"
+
+using namespace PololuJrkUSB;
+
+// Samples current and duty cycle of an emulated jrk at 1kHz through a
+// TelemetryAggregator with 100ms windows, and reports how much less data the
+// window summaries amount to than the raw stream. Then measures the cost of
+// Record(), and the accuracy of the quantile sketches against exact
+// quantiles of a synthetic stream.
+
+constexpr auto Window = std::chrono::milliseconds(100);
+constexpr auto Period = std::chrono::milliseconds(1);
+constexpr auto Duration = std::chrono::seconds(3);
+constexpr int CurrentThreshold = 40;
+// what shipping a raw sample would cost: timestamp, variable, value
+constexpr size_t RawSampleBytes = sizeof(uint64_t) + 1 + sizeof(int32_t);
+
+static void Live() {
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency);
+  TelemetryConfig cfg;
+  cfg.window = Window;
+  std::vector<WindowSummary> emitted;
+  TelemetryAggregator agg([&emitted](const WindowSummary& w){
+      emitted.push_back(w);
+    }, cfg);
+  agg.SetThreshold(JrkVar::Current, CurrentThreshold);
+  p.SetReplyCallback(agg.Callback());
+  std::thread usb(&Poller::Poll, std::ref(p));
+
+  auto next = std::chrono::steady_clock::now();
+  const auto end = next + Duration;
+  int tick = 0;
+  while(next < end){
+    if(tick % 250 == 0){ // swing the motor back and forth
+      p.SetJrkTarget(tick % 500 ? 1800 : 2200);
+    }
+    p.ReadJrkCurrent();
+    p.ReadJrkDutyCycle();
+    ++tick;
+    next += Period;
+    std::this_thread::sleep_until(next);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  p.StopPolling();
+  usb.join();
+  agg.Flush();
+
+  for(const auto& w : emitted){
+    if(w.start == emitted.back().start || &w == &emitted[0] || &w == &emitted[1]){
+      std::cout << "  " << w << std::endl;
+    }
+  }
+  const auto samples = agg.Samples();
+  const auto rawbytes = samples * RawSampleBytes;
+  const auto sumbytes = emitted.size() * sizeof(WindowSummary);
+  std::cout << samples << " samples (" << rawbytes << " bytes raw) -> "
+            << emitted.size() << " summaries (" << sumbytes << " bytes), "
+            << std::fixed << std::setprecision(1)
+            << static_cast<double>(rawbytes) / sumbytes << "x reduction" << std::endl;
+  std::cout << "last raw samples retained for dumps:" << std::endl;
+  auto raw = agg.Raw();
+  std::cout << "  " << raw.size() << " of " << cfg.rawsamples << ", ending with "
+            << JrkDescribe(raw.back().var).name << " " << raw.back().value << std::endl;
+}
+
+static void Synthetic() {
+  constexpr unsigned Samples = 1000000;
+  TelemetryConfig cfg;
+  cfg.window = std::chrono::hours(1); // everything lands in one window
+  WindowSummary sum{};
+  TelemetryAggregator agg([&sum](const WindowSummary& w){ sum = w; }, cfg);
+  std::mt19937 rng(0);
+  std::gamma_distribution<double> dist(2.0, 40.0); // current-like: skewed
+  std::vector<int> values(Samples);
+  for(auto& v : values){
+    v = std::min(255, static_cast<int>(dist(rng)));
+  }
+  const auto when = std::chrono::steady_clock::now();
+  const auto start = std::chrono::steady_clock::now();
+  for(auto v : values){
+    agg.Record(JrkVar::Current, v, when);
+  }
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+  agg.Flush();
+  std::cout << "Record(): " << std::fixed << std::setprecision(1)
+            << static_cast<double>(ns) / Samples << " ns/sample" << std::endl;
+  std::sort(values.begin(), values.end());
+  for(size_t i = 0 ; i < TelemetryQuantileCount ; ++i){
+    const double exact = values[static_cast<size_t>(TelemetryQuantiles[i] * (Samples - 1))];
+    std::cout << "  p" << std::defaultfloat << std::setprecision(3) << TelemetryQuantiles[i] * 100
+              << std::fixed << std::setprecision(1) << ": sketch " << sum.quantiles[i] << " exact " << exact
+              << " (" << std::setprecision(2) << std::abs(sum.quantiles[i] - exact) / exact * 100
+              << "% error)" << std::endl;
+  }
+  std::cout << "aggregator state: " << sizeof(TelemetryAggregator) << " bytes + "
+            << cfg.rawsamples * sizeof(RawSample) << " bytes of raw ring" << std::endl;
+}
+
+int main(void){
+  Live();
+  Synthetic();
+  return 0;
+}
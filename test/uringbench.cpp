@@ -0,0 +1,95 @@
+#include <mutex>
+#include <thread>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include <condition_variable>
+#include "poller.h"
+#include "emulator.h"
+#include "allochook.h"
+
+using namespace PololuJrkUSB;
+
+// Compares the poll() and io_uring Poller backends on an emulated jrk,
+// keeping a window of reads outstanding. Reports throughput, and syscalls
+// and CPU time (of the whole process, emulator included) per reply, and
+// allocations per million replies.
+
+constexpr int Replies = 200000;
+constexpr int Window = 32;
+
+static double CPUSeconds() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void Bench(const char* name, PollerBackend backend) {
+  JrkEmulator emu;
+  Poller p(emu.Path().c_str(), nullptr, PollerTransport::LowLatency, backend);
+  p.ReserveReads(Window);
+  std::mutex lock;
+  std::condition_variable cv;
+  int outstanding = 0;
+  int completed = 0;
+  struct {
+    std::mutex& lock;
+    std::condition_variable& cv;
+    int& outstanding;
+    int& completed;
+  } state{ lock, cv, outstanding, completed, };
+  // captures a single pointer, so std::function needn't allocate
+  auto done = [st = &state](const JrkVariable&, int, int){
+    std::lock_guard<std::mutex> guard(st->lock);
+    --st->outstanding;
+    ++st->completed;
+    st->cv.notify_one();
+  };
+  std::thread usb(&Poller::Poll, std::ref(p));
+  AllocHook::Arm();
+  const auto cpu = CPUSeconds();
+  const auto start = std::chrono::steady_clock::now();
+  int sent = 0;
+  while(sent < Replies){
+    int room;
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      cv.wait(lk, [&]{ return outstanding < Window / 2; });
+      room = std::min(Window - outstanding, Replies - sent);
+      outstanding += room;
+    }
+    for(int i = 0 ; i < room ; ++i){
+      p.ReadJrk(JrkVar::Feedback, done);
+    }
+    sent += room;
+  }
+  {
+    std::unique_lock<std::mutex> lk(lock);
+    cv.wait(lk, [&]{ return completed == Replies; });
+  }
+  const double secs = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+  const double cpusecs = CPUSeconds() - cpu;
+  const auto allocs = AllocHook::Disarm();
+  p.StopPolling();
+  usb.join();
+  auto s = p.Stats();
+  std::cout << std::fixed << std::setprecision(2) << name << ": "
+            << Replies / secs << " replies/s, "
+            << static_cast<double>(s.syscalls) / s.replies << " poller syscalls/reply, "
+            << static_cast<double>(s.wakeups) / s.replies << " wakeups/reply, "
+            << cpusecs * 1e6 / Replies << " CPU us/reply, "
+            << allocs * 1e6 / Replies << " allocs/1M replies" << std::endl;
+}
+
+int main(void){
+  Bench("poll", PollerBackend::Poll);
+  try{
+    Bench("io_uring", PollerBackend::IoUring);
+  }catch(std::runtime_error& e){
+    std::cerr << "io_uring unavailable: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}